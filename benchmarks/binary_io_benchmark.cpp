@@ -0,0 +1,131 @@
+#include "harness.h"
+
+#include "rosban_utils/io_tools.h"
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+using namespace rosban_utils;
+
+namespace
+{
+
+/// Number of (double, int) pairs written value by value
+const int nb_pairs = 1 << 16;
+
+const size_t data_size = nb_pairs * (sizeof(double) + sizeof(int));
+
+void writeValues(std::ostream & out)
+{
+  for (int idx = 0; idx < nb_pairs; idx++) {
+    write<double>(out, idx * 0.5);
+    write<int>(out, idx);
+  }
+}
+
+void writeValues(BinaryWriter & out)
+{
+  for (int idx = 0; idx < nb_pairs; idx++) {
+    write<double>(out, idx * 0.5);
+    write<int>(out, idx);
+  }
+}
+
+/// Return the sum of the values read, used to keep the reads alive
+template <typename In>
+double readValues(In & in)
+{
+  double sum = 0;
+  for (int idx = 0; idx < nb_pairs; idx++) {
+    double value;
+    int count;
+    read<double>(in, &value);
+    read<int>(in, &count);
+    sum += value + count;
+  }
+  return sum;
+}
+
+}
+
+/// Throughput of BinaryWriter and BinaryReader against the per-value
+/// std::ostream and std::istream path on data written value by value, which
+/// is the typical content of StreamSerializable::writeInternal. The
+/// 'adapter' cases are the std::istream path of classes which do not
+/// override the BinaryReader overloads
+int main(int argc, char ** argv)
+{
+  MicroBenchmark bench;
+  std::ostringstream oss;
+  writeValues(oss);
+  const std::string data = oss.str();
+  // Median durations of an iteration [s]
+  double ostream_time =
+    bench.run("write_ostream", [&oss]()
+              {
+                oss.seekp(0);
+                writeValues(oss);
+                MicroBenchmark::doNotOptimize(oss);
+              }).median;
+  double stream_writer_time =
+    bench.run("write_binary_writer_stream", [&oss]()
+              {
+                oss.seekp(0);
+                BinaryWriter writer(oss);
+                writeValues(writer);
+                writer.flush();
+                MicroBenchmark::doNotOptimize(oss);
+              }).median;
+  BinaryWriter memory_writer;
+  double memory_writer_time =
+    bench.run("write_binary_writer_memory", [&memory_writer]()
+              {
+                memory_writer.clear();
+                writeValues(memory_writer);
+                MicroBenchmark::doNotOptimize(memory_writer.getSize());
+              }).median;
+  std::istringstream iss(data);
+  double istream_time =
+    bench.run("read_istream", [&iss]()
+              {
+                iss.clear();
+                iss.seekg(0);
+                MicroBenchmark::doNotOptimize(readValues(iss));
+              }).median;
+  double stream_reader_time =
+    bench.run("read_binary_reader_stream", [&iss]()
+              {
+                iss.clear();
+                iss.seekg(0);
+                BinaryReader reader(iss);
+                MicroBenchmark::doNotOptimize(readValues(reader));
+              }).median;
+  double memory_reader_time =
+    bench.run("read_binary_reader_memory", [&data]()
+              {
+                BinaryReader reader(data.data(), data.size());
+                MicroBenchmark::doNotOptimize(readValues(reader));
+              }).median;
+  double adapter_time =
+    bench.run("read_binary_reader_adapter", [&data]()
+              {
+                BinaryReader reader(data.data(), data.size());
+                BinaryReaderBuffer buffer(reader);
+                std::istream in(&buffer);
+                MicroBenchmark::doNotOptimize(readValues(in));
+              }).median;
+  double mb = data_size / 1e6;
+  std::ostringstream summary;
+  summary << std::fixed << std::setprecision(0)
+          << "write: ostream " << mb / ostream_time << " MB/s"
+          << ", BinaryWriter on ostream " << mb / stream_writer_time << " MB/s"
+          << ", BinaryWriter in memory " << mb / memory_writer_time << " MB/s" << std::endl
+          << "read: istream " << mb / istream_time << " MB/s"
+          << ", BinaryReader on istream " << mb / stream_reader_time << " MB/s"
+          << ", BinaryReader in memory " << mb / memory_reader_time << " MB/s"
+          << ", istream adapter " << mb / adapter_time << " MB/s" << std::endl;
+  std::cout << summary.str();
+  return finishHarness(bench, argc, argv);
+}
@@ -0,0 +1,139 @@
+#include "harness.h"
+
+#include "rosban_utils/io_tools.h"
+
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace rosban_utils;
+
+namespace
+{
+
+const int nb_values = 4096;
+
+/// Tolerance of the quantized codec, resolution of the smooth doubles
+const double tolerance = 5e-4;
+
+/// Measure the size and the median write and read durations of a codec on a
+/// dataset and append them to 'summary', 'raw_size' is the size written by
+/// the raw path
+void measure(MicroBenchmark & bench, const std::string & name, size_t raw_size,
+             const std::function<void(BinaryWriter &)> & write,
+             const std::function<void(BinaryReader &)> & read,
+             std::ostream & summary)
+{
+  BinaryWriter writer;
+  write(writer);
+  size_t size = writer.getSize();
+  double write_time =
+    bench.run("write_" + name, [&writer, &write]()
+              {
+                writer.clear();
+                write(writer);
+                MicroBenchmark::doNotOptimize(writer.getSize());
+              }).median;
+  double read_time =
+    bench.run("read_" + name, [&writer, &read]()
+              {
+                BinaryReader reader(writer.getData(), writer.getSize());
+                read(reader);
+              }).median;
+  double mb = raw_size / 1e6;
+  summary << std::fixed << std::setprecision(2)
+          << name << ": ratio " << double(raw_size) / size
+          << std::setprecision(0)
+          << ", write " << mb / write_time << " MB/s"
+          << ", read " << mb / read_time << " MB/s" << std::endl;
+}
+
+}
+
+/// Size and throughput of the array codecs on typical logged data, compared
+/// to writeIntArray and writeDoubleArray on the same values. Throughputs are
+/// given in MB of raw data per second
+int main(int argc, char ** argv)
+{
+  std::vector<double> smooth(nb_values), noise(nb_values);
+  std::vector<int> counters(nb_values), small(nb_values);
+  std::mt19937 engine(42);
+  std::uniform_real_distribution<double> distribution(-1, 1);
+  std::uniform_int_distribution<int> small_distribution(-50, 50);
+  for (int idx = 0; idx < nb_values; idx++) {
+    // Sensor sampled at 1kHz, stored with a resolution of 1e-3
+    smooth[idx] = std::round(1000 * std::sin(idx * 1e-3)) / 1000;
+    noise[idx] = distribution(engine);
+    counters[idx] = 1000000 + 3 * idx;
+    small[idx] = small_distribution(engine);
+  }
+  std::vector<double> read_doubles(nb_values);
+  std::vector<int> read_ints(nb_values);
+  size_t doubles_size = nb_values * sizeof(double);
+  size_t ints_size = nb_values * sizeof(int);
+
+  MicroBenchmark bench;
+  std::ostringstream summary;
+  for (const auto & dataset : { std::make_pair(std::string("smooth_doubles"), &smooth),
+                                std::make_pair(std::string("random_doubles"), &noise) }) {
+    const std::string & name = dataset.first;
+    const std::vector<double> & values = *dataset.second;
+    measure(bench, "raw_" + name, doubles_size,
+            [&values](BinaryWriter & out) { writeDoubleArray(out, values.data(), nb_values); },
+            [&read_doubles](BinaryReader & in)
+            {
+              readDoubleArray(in, read_doubles.data(), nb_values);
+              MicroBenchmark::doNotOptimize(read_doubles);
+            }, summary);
+    measure(bench, "xor_" + name, doubles_size,
+            [&values](BinaryWriter & out) { writeXorDoubleArray(out, values.data(), nb_values); },
+            [&read_doubles](BinaryReader & in)
+            {
+              readXorDoubleArray(in, read_doubles.data(), nb_values);
+              MicroBenchmark::doNotOptimize(read_doubles);
+            }, summary);
+    measure(bench, "quantized_" + name, doubles_size,
+            [&values](BinaryWriter & out)
+            {
+              writeQuantizedDoubleArray(out, values.data(), nb_values, tolerance);
+            },
+            [&read_doubles](BinaryReader & in)
+            {
+              readQuantizedDoubleArray(in, read_doubles.data(), nb_values);
+              MicroBenchmark::doNotOptimize(read_doubles);
+            }, summary);
+  }
+  for (const auto & dataset : { std::make_pair(std::string("counters"), &counters),
+                                std::make_pair(std::string("small_ints"), &small) }) {
+    const std::string & name = dataset.first;
+    const std::vector<int> & values = *dataset.second;
+    measure(bench, "raw_" + name, ints_size,
+            [&values](BinaryWriter & out) { writeIntArray(out, values.data(), nb_values); },
+            [&read_ints](BinaryReader & in)
+            {
+              readIntArray(in, read_ints.data(), nb_values);
+              MicroBenchmark::doNotOptimize(read_ints);
+            }, summary);
+    measure(bench, "varint_" + name, ints_size,
+            [&values](BinaryWriter & out) { writeVarIntArray(out, values.data(), nb_values); },
+            [&read_ints](BinaryReader & in)
+            {
+              readVarIntArray(in, read_ints.data(), nb_values);
+              MicroBenchmark::doNotOptimize(read_ints);
+            }, summary);
+    measure(bench, "delta_" + name, ints_size,
+            [&values](BinaryWriter & out) { writeDeltaIntArray(out, values.data(), nb_values); },
+            [&read_ints](BinaryReader & in)
+            {
+              readDeltaIntArray(in, read_ints.data(), nb_values);
+              MicroBenchmark::doNotOptimize(read_ints);
+            }, summary);
+  }
+  std::cout << summary.str();
+  return finishHarness(bench, argc, argv);
+}
@@ -0,0 +1,92 @@
+#include "harness.h"
+
+#include "rosban_utils/compression.h"
+
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace rosban_utils;
+
+namespace
+{
+
+/// Serialized content of 'values'
+template <typename T>
+std::vector<char> toBytes(const std::vector<T> & values)
+{
+  std::vector<char> bytes(values.size() * sizeof(T));
+  std::memcpy(bytes.data(), values.data(), bytes.size());
+  return bytes;
+}
+
+}
+
+/// Ratio and throughput of the LZ compression on a block of LZ_BLOCK_SIZE
+/// bytes for typical logged data, copying the block gives the cost of the
+/// uncompressed path
+int main(int argc, char ** argv)
+{
+  size_t nb_doubles = LZ_BLOCK_SIZE / sizeof(double);
+  std::vector<double> smooth(nb_doubles), noise(nb_doubles);
+  std::vector<uint32_t> counters(LZ_BLOCK_SIZE / sizeof(uint32_t));
+  std::mt19937 engine(42);
+  std::uniform_real_distribution<double> distribution(-1, 1);
+  for (size_t idx = 0; idx < nb_doubles; idx++) {
+    // Sensor sampled at 1kHz, stored with a resolution of 1e-3
+    smooth[idx] = std::round(1000 * std::sin(idx * 1e-3)) / 1000;
+    noise[idx] = distribution(engine);
+  }
+  for (size_t idx = 0; idx < counters.size(); idx++) {
+    counters[idx] = idx / 4;
+  }
+  std::vector<std::pair<std::string, std::vector<char>>> datasets;
+  datasets.push_back(std::make_pair("smooth_doubles", toBytes(smooth)));
+  datasets.push_back(std::make_pair("random_doubles", toBytes(noise)));
+  datasets.push_back(std::make_pair("counters", toBytes(counters)));
+
+  MicroBenchmark bench;
+  std::vector<char> compressed(lzCompressBound(LZ_BLOCK_SIZE));
+  std::vector<char> decompressed(LZ_BLOCK_SIZE);
+  std::ostringstream summary;
+  for (const auto & dataset : datasets) {
+    const std::string & name = dataset.first;
+    const std::vector<char> & raw = dataset.second;
+    size_t compressed_size = lzCompress(raw.data(), raw.size(), compressed.data());
+    // Median durations of an iteration [s]
+    double compression_time =
+      bench.run("compress_" + name, [&raw, &compressed]()
+                {
+                  size_t size = lzCompress(raw.data(), raw.size(), compressed.data());
+                  MicroBenchmark::doNotOptimize(size);
+                }).median;
+    double decompression_time =
+      bench.run("decompress_" + name, [&raw, &compressed, &decompressed, compressed_size]()
+                {
+                  lzDecompress(compressed.data(), compressed_size,
+                               decompressed.data(), raw.size());
+                  MicroBenchmark::doNotOptimize(decompressed);
+                }).median;
+    double copy_time =
+      bench.run("copy_" + name, [&raw, &decompressed]()
+                {
+                  std::memcpy(decompressed.data(), raw.data(), raw.size());
+                  MicroBenchmark::doNotOptimize(decompressed);
+                }).median;
+    double mb = raw.size() / 1e6;
+    summary << std::fixed << std::setprecision(2)
+            << name << ": ratio " << double(raw.size()) / compressed_size
+            << std::setprecision(0)
+            << ", compress " << mb / compression_time << " MB/s"
+            << ", decompress " << mb / decompression_time << " MB/s"
+            << ", copy " << mb / copy_time << " MB/s" << std::endl;
+  }
+  std::cout << summary.str();
+  return finishHarness(bench, argc, argv);
+}
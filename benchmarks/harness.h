@@ -0,0 +1,32 @@
+#pragma once
+
+#include "rosban_utils/micro_benchmark.h"
+
+#include <iostream>
+#include <string>
+
+namespace rosban_utils
+{
+
+/// Common end of the benchmark harnesses: print the results, then depending
+/// on the arguments:
+/// - '--save <path>': save the results as a baseline
+/// - '--compare <path>': compare to a baseline, the exit status is the number
+///   of regressions
+inline int finishHarness(const MicroBenchmark & bench, int argc, char ** argv)
+{
+  bench.print();
+  if (argc == 1) return 0;
+  std::string command = argv[1];
+  if (argc == 3 && command == "--save") {
+    bench.saveBaseline(argv[2]);
+    return 0;
+  }
+  if (argc == 3 && command == "--compare") {
+    return bench.compareToBaseline(argv[2]);
+  }
+  std::cerr << "Usage: " << argv[0] << " [--save <path> | --compare <path>]" << std::endl;
+  return -1;
+}
+
+}
@@ -0,0 +1,50 @@
+#include "harness.h"
+
+#include "rosban_utils/multi_core.h"
+
+#include <cmath>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace rosban_utils;
+
+/// Cost of a parallel call with small jobs: workers of a Pool against one
+/// new thread per job, which is what the Pool replaced
+int main(int argc, char ** argv)
+{
+  MicroBenchmark bench;
+  for (int nb_jobs : {2, 4, 8}) {
+    std::vector<double> results(nb_jobs);
+    MultiCore::Pool::Job job = [&results](int job_idx)
+      {
+        double acc = 0;
+        for (int i = 0; i < 1000; i++) {
+          acc += std::sqrt(i + job_idx);
+        }
+        results[job_idx] = acc;
+      };
+    std::string suffix = "_" + std::to_string(nb_jobs) + "_jobs";
+    MultiCore::Pool pool(nb_jobs);
+    bench.run("pool" + suffix, [&pool, &job, nb_jobs]() { pool.run(nb_jobs, job); });
+    bench.run("spawn" + suffix, [&job, nb_jobs]()
+              {
+                std::vector<std::thread> threads;
+                for (int job_idx = 1; job_idx < nb_jobs; job_idx++) {
+                  threads.push_back(std::thread(job, job_idx));
+                }
+                job(0);
+                for (std::thread & thread : threads) {
+                  thread.join();
+                }
+              });
+    bench.run("sequential" + suffix, [&job, nb_jobs]()
+              {
+                for (int job_idx = 0; job_idx < nb_jobs; job_idx++) {
+                  job(job_idx);
+                }
+              });
+    MicroBenchmark::doNotOptimize(results);
+  }
+  return finishHarness(bench, argc, argv);
+}
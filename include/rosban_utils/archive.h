@@ -0,0 +1,134 @@
+#pragma once
+
+#include "rosban_utils/factory.h"
+#include "rosban_utils/io_tools.h"
+#include "rosban_utils/mapped_file.h"
+#include "rosban_utils/multi_core.h"
+#include "rosban_utils/stream_serializable.h"
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace rosban_utils
+{
+
+/// Archives store many StreamSerializable objects in a single file:
+/// - Header: magic "RBAR" and format version (int)
+/// - Records: magic "RBRC", length (uint64_t) of the following bytes, class
+///   ID (int) and content written by writeInternal
+/// - Footer: offset (uint64_t) of each record, number of records (uint64_t),
+///   offset of the footer (uint64_t) and magic "RBAI"
+/// The footer allows random access to any record. If an archive was not
+/// closed properly, the footer is missing or invalid and records are found by
+/// scanning the file, incomplete records at the end are ignored. The magic of
+/// the records ensures that a partially written footer is not taken for a record.
+class ArchiveWriter
+{
+public:
+  /// Create an archive at 'path', if 'append' is true and the file exists,
+  /// new records are added after the existing ones
+  ArchiveWriter(const std::string & path, bool append = false);
+  /// Close the archive if close was not called
+  ~ArchiveWriter();
+
+  ArchiveWriter(const ArchiveWriter & other) = delete;
+  ArchiveWriter & operator=(const ArchiveWriter & other) = delete;
+
+  /// Add a record and return its index
+  size_t write(const StreamSerializable & object);
+
+  size_t getNbRecords() const;
+
+  /// Write the footer, no records can be added afterwards
+  void close();
+
+private:
+  std::string path;
+  std::ofstream file;
+  std::unique_ptr<BinaryWriter> writer;
+  /// Offset in the file of the first byte written by writer
+  uint64_t base_offset;
+  /// Record content is serialized in memory first to know its length
+  BinaryWriter record;
+  /// Offset of each record
+  std::vector<uint64_t> offsets;
+  bool is_closed;
+};
+
+/// Random access to the records of an archive, the file is mapped in memory.
+/// Reading records is thread-safe
+class ArchiveReader
+{
+public:
+  ArchiveReader(const std::string & path);
+
+  size_t getNbRecords() const;
+
+  /// Class ID of the given record
+  int getClassID(size_t index) const;
+
+  /// Size of the content of the record [bytes]
+  size_t getRecordSize(size_t index) const;
+
+  /// Return a reader on the content of the record, class ID excluded
+  std::unique_ptr<BinaryReader> getRecordReader(size_t index) const;
+
+  /// Read the content of the record in 'object', throw a runtime_error if
+  /// the class ID does not match
+  void read(size_t index, StreamSerializable & object) const;
+
+  /// Build the object stored in the record with the factory
+  template <class T>
+  std::unique_ptr<T> read(size_t index, Factory<T> & factory) const
+    {
+      std::unique_ptr<BinaryReader> reader = getReader(index);
+      std::unique_ptr<T> object;
+      factory.read(*reader, object);
+      return object;
+    }
+
+  /// Build all the records in [start, end[ using 'nb_threads' threads
+  template <class T>
+  std::vector<std::unique_ptr<T>> readRange(size_t start, size_t end,
+                                            Factory<T> & factory, int nb_threads = 1) const
+    {
+      if (start > end || end > offsets.size()) {
+        throw std::out_of_range("ArchiveReader::readRange: invalid range");
+      }
+      std::vector<std::unique_ptr<T>> objects(end - start);
+      MultiCore::runParallelTask([this, start, &objects, &factory](int task_start, int task_end)
+                                 {
+                                   for (int task = task_start; task < task_end; task++) {
+                                     objects[task] = read<T>(start + task, factory);
+                                   }
+                                 }, end - start, nb_threads);
+      return objects;
+    }
+
+private:
+  /// Reader on the class ID and the content of a record
+  std::unique_ptr<BinaryReader> getReader(size_t index) const;
+
+  /// Return true if a complete record starts at 'offset' and ends before
+  /// 'limit', its length is then stored in 'length'
+  bool readRecordHeader(uint64_t offset, uint64_t limit, uint64_t & length) const;
+
+  /// Read the footer, return false if there is no valid footer
+  bool readFooter();
+
+  /// Find records by reading the file sequentially
+  void scanRecords();
+
+  std::shared_ptr<MappedFile> file;
+  /// Offset of each record
+  std::vector<uint64_t> offsets;
+  /// End of the last record
+  uint64_t data_end;
+
+  friend class ArchiveWriter;
+};
+
+}
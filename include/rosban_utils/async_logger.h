@@ -0,0 +1,174 @@
+#pragma once
+
+#include "rosban_utils/io_tools.h"
+#include "rosban_utils/stream_serializable.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rosban_utils
+{
+
+/// Log StreamSerializable objects to a file without performing any file
+/// access in the calling thread. Objects are serialized directly into a ring
+/// of preallocated buffers and full buffers are written by a background
+/// thread, so memory usage is bounded by nb_buffers * buffer_size. The
+/// background thread also writes the objects of a partially filled buffer
+/// once they are older than flush_period.
+///
+/// The file is the concatenation of the objects written with
+/// StreamSerializable::write (class ID and content), it can be read back
+/// sequentially with a BinaryReader and a Factory.
+///
+/// log, flush and close should not be called concurrently, typically they
+/// are called from a single thread. The ring is lock-free between the
+/// logging thread and the background thread.
+class AsyncLogger
+{
+public:
+  /// Behavior when an object is logged while all the buffers are waiting
+  /// to be written
+  enum class OverflowPolicy
+  {
+    /// The object is discarded and counted as a drop
+    Drop,
+    /// The calling thread waits until a buffer is available
+    Block
+  };
+
+  struct Config
+  {
+    Config();
+
+    /// Size of each buffer, objects larger than a buffer cannot be logged [bytes]
+    size_t buffer_size;
+    /// Number of buffers in the ring, at least 2
+    int nb_buffers;
+    OverflowPolicy policy;
+    /// Objects of a partially filled buffer are written once they have been
+    /// waiting for flush_period, thus at most twice flush_period after being
+    /// logged, even if no objects are logged afterwards [s]
+    double flush_period;
+  };
+
+  struct Stats
+  {
+    /// Number of objects accepted
+    uint64_t nb_records;
+    /// Number of bytes accepted
+    uint64_t nb_bytes_logged;
+    /// Number of bytes written to the file
+    uint64_t nb_bytes_written;
+    /// Number of objects discarded because no buffer was available
+    uint64_t nb_drops;
+    /// Maximal time spent in log, including waiting with Block policy [s]
+    double max_enqueue_latency;
+  };
+
+  /// Create or truncate the file at 'path' and start the background thread
+  AsyncLogger(const std::string & path, const Config & config = Config());
+  /// Close the logger if close was not called
+  ~AsyncLogger();
+
+  AsyncLogger(const AsyncLogger & other) = delete;
+  AsyncLogger & operator=(const AsyncLogger & other) = delete;
+
+  /// Serialize the object in the current buffer. Return false if the object
+  /// was dropped. Throw a runtime_error if the object is larger than a
+  /// buffer or if the background thread failed to write to the file
+  bool log(const StreamSerializable & object);
+
+  /// Send the current buffer to the background thread without waiting for
+  /// flush_period, this does not wait for the data to be written
+  void flush();
+
+  /// Write all pending data, stop the background thread and close the file.
+  /// Throw a runtime_error if writing failed, no objects can be logged afterwards
+  void close();
+
+  Stats getStats() const;
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Buffer
+  {
+    std::vector<char> data;
+    /// Number of bytes used in data, increased by the logging thread once the
+    /// bytes are written and reset by the background thread
+    std::atomic<size_t> used;
+  };
+
+  /// Take the next buffer of the ring if it is free, wait for it with Block
+  /// policy. Return false if no buffer could be acquired
+  bool acquireBuffer();
+
+  /// Give the current buffer to the background thread
+  void submitBuffer();
+
+  /// Serialize the object in record and copy it to the next buffer, used
+  /// when it does not fit in the current one. Return false if the object was
+  /// dropped, throw a runtime_error if it is larger than a buffer
+  bool logRecord(const StreamSerializable & object);
+
+  /// Main loop of the background thread
+  void run();
+
+  /// Wait until a buffer is submitted after 'index' buffers, a stop is
+  /// requested or flush_period has elapsed. Return false in the last case
+  bool waitForData(uint64_t index);
+
+  /// Write the bytes [start, end[ of the buffer to the file, return end
+  size_t writeData(const Buffer & buffer, size_t start, size_t end);
+
+  /// Throw a runtime_error if the background thread failed
+  void checkError() const;
+
+  std::string path;
+  std::ofstream file;
+  Config config;
+
+  std::vector<Buffer> buffers;
+  /// Number of buffers submitted by the logging thread
+  std::atomic<uint64_t> nb_submitted;
+  /// Number of buffers written by the background thread
+  std::atomic<uint64_t> nb_written;
+  /// Is the buffer nb_submitted % nb_buffers owned by the logging thread
+  bool has_current;
+
+  /// Objects which do not fit in the space left in the current buffer are
+  /// serialized here to know their size
+  BinaryWriter record;
+
+  std::atomic<uint64_t> nb_records;
+  std::atomic<uint64_t> nb_bytes_logged;
+  std::atomic<uint64_t> nb_bytes_written;
+  std::atomic<uint64_t> nb_drops;
+  /// Stored in nanoseconds to remain lock-free
+  std::atomic<int64_t> max_enqueue_latency;
+
+  /// Only used for sleeping: a thread sets its waiting flag while holding
+  /// the mutex before checking the ring, the other thread only locks the
+  /// mutex and notifies if the flag is set, thus logging does not require
+  /// any system call while the background thread is busy
+  std::mutex mutex;
+  std::condition_variable data_condition;
+  std::condition_variable space_condition;
+  std::atomic<bool> is_background_waiting;
+  std::atomic<bool> is_logging_waiting;
+
+  std::atomic<bool> stop_requested;
+  std::atomic<bool> has_failed;
+  bool is_closed;
+  std::thread thread;
+};
+
+}
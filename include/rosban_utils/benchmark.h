@@ -1,35 +1,332 @@
 #pragma once
 
+#include "rosban_utils/latency_histogram.h"
+#include "rosban_utils/perf_counters.h"
 #include "rosban_utils/time_stamp.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
 #include <iostream>
+#include <array>
 #include <memory>
+#include <mutex>
 #include <vector>
 #include <string>
 #include <stdexcept>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 namespace rosban_utils {
 
-/// This class allows to provide benchmark in mono-thread situation.
+/// This class allows to provide benchmark in mono-thread or multi-thread situation.
 /// It ensures a low time consumption, except when printing results
 /// It is based on the notion of zone and build a tree of consumption
+///
+/// Each thread has its own current zone, thus opening and closing zones does not
+/// require any synchronization. A thread without open zones can be attached to
+/// the WorkerGroup of a zone of another thread (see Attachment): the zones it
+/// opens are then recorded in a tree owned by the group and dedicated to this
+/// thread, without any lock. These trees are merged into the zone owning the
+/// group once, when the root zone of its thread is closed, when the zone is
+/// written or when absorbThreadTrees is called. MultiCore attaches the threads
+/// running the tasks of a parallel call to the group of the zone surrounding
+/// the call, thus zones opened inside tasks appear inside this zone, with times
+/// summed over all threads.
 class Benchmark
 {
 public:
-  Benchmark(std::shared_ptr<Benchmark> father, const std::string & name);
+  /// Zone which is opened at construction and closed at destruction, even if
+  /// an exception is thrown. Name should be a string literal: once the zone
+  /// has been opened once inside its parent, it is found by comparing
+  /// addresses and reopening it does not require any allocation.
+  /// If ROSBAN_UTILS_DISABLE_BENCHMARK is defined, it does nothing
+  class Scope
+  {
+  public:
+#ifdef ROSBAN_UTILS_DISABLE_BENCHMARK
+    explicit Scope(const char * name) { (void)name; }
+#else
+    explicit Scope(const char * name) { openStatic(name); }
+    ~Scope() { close(); }
+#endif
+    Scope(const Scope & other) = delete;
+    Scope & operator=(const Scope & other) = delete;
+  };
+
+  /// Thread writing periodically snapshots of the zones of all threads, both
+  /// cumulative and since the previous snapshot, without closing them.
+  /// The reporting thread copies the trees itself: the statistics of each
+  /// zone are protected by a sequence counter, thus instrumented threads only
+  /// wait for the reporter when they add a zone to their tree. Open zones
+  /// include the time of their current call.
+  class Reporter
+  {
+  public:
+    /// Write a snapshot to 'out' every 'interval' seconds, 'out' should
+    /// outlive the reporter
+    Reporter(std::ostream & out, double interval, int detail_level = -1);
+    /// Append a snapshot to the file at 'path' every 'interval' seconds
+    Reporter(const std::string & path, double interval, int detail_level = -1);
+    ~Reporter();
+
+    Reporter(const Reporter & other) = delete;
+    Reporter & operator=(const Reporter & other) = delete;
+
+    /// Stop the reporting thread, automatically called on destruction
+    void stop();
+
+  private:
+    void start();
+    /// Main loop of the reporting thread
+    void run();
+    /// Take a snapshot and write it
+    void report();
+
+    /// Only used when writing to a file
+    std::unique_ptr<std::ofstream> file;
+    std::ostream * out;
+    /// Time between two snapshots [s]
+    double interval;
+    int detail_level;
+    int nb_snapshots;
+    /// Previous snapshot, used to compute differences
+    std::shared_ptr<Benchmark> previous;
+    TimeStamp previous_time;
+    /// Protects stopping
+    std::mutex mutex;
+    std::condition_variable stop_condition;
+    bool stopping;
+    std::thread thread;
+  };
+
+  /// Output produced when closing a zone
+  enum class Format
+  {
+    /// Nothing is written
+    None,
+    /// Indented tree, see print
+    Text,
+    /// Chrome Trace Event JSON, can be loaded in chrome://tracing or Perfetto,
+    /// each thread has its own track
+    ChromeTrace,
+    /// One line per stack with its self time in microseconds, format used by
+    /// flamegraph tools
+    FoldedStacks
+  };
+
+  /// Source of time used to measure zones
+  enum class Clock
+  {
+    /// std::chrono::steady_clock, reliable but each read can cost tens of ns
+    Steady,
+    /// Time Stamp Counter of the processor, only available on x86 processors
+    /// with an invariant TSC, calibrated against steady_clock
+    TSC
+  };
+
+  /// Distribution of the durations of the calls of a zone [s]
+  struct Latencies
+  {
+    /// Number of calls recorded in the histogram
+    int nb_calls;
+    double p50;
+    double p90;
+    double p99;
+    double p999;
+    double max;
+  };
+
+  /// Trees of the threads working on behalf of a zone, see getWorkerGroup
+  struct WorkerGroup;
+
+  /// While it exists, the zones opened by the calling thread are recorded for
+  /// 'group' and merged later into the zone owning it. Nothing is done if
+  /// 'group' is null or if the calling thread already has open zones, which
+  /// are then simply nested in its current zone.
+  /// The zone owning the group should not be closed before the end of the
+  /// attachment, e.g. threads should be joined first
+  class Attachment
+  {
+  public:
+    explicit Attachment(const std::shared_ptr<WorkerGroup> & group);
+    ~Attachment();
+
+    Attachment(const Attachment & other) = delete;
+    Attachment & operator=(const Attachment & other) = delete;
+
+  private:
+    /// Is the thread attached by this object
+    bool is_active;
+    /// Attachment of the thread before this one
+    std::shared_ptr<WorkerGroup> previous_group;
+    Benchmark * previous_tree;
+  };
+
+  Benchmark(Benchmark * father, const std::string & name);
   ~Benchmark();
 
   /// Open a new benchmark or subBenchmark (if current benchmark is not null)
-  /// It is not recommended to open several subBenchmark with the same name
+  /// If the current benchmark already has a subBenchmark with the same name,
+  /// it is reopened and the new call is aggregated with the previous ones,
+  /// thus memory does not grow when a zone is opened inside a loop.
+  /// Similarly, a root zone reuses the emptied tree of the previous root zone
+  /// of the thread if they have the same name
   static void open(const std::string &benchmark_name);
 
+  /// Same as open but 'benchmark_name' is expected to have a static storage
+  /// (e.g. a string literal), which allows faster lookup of existing zones
+  static void openStatic(const char * benchmark_name);
+
   /// Close current benchmark or subBenchmark and return to previous context
   /// if needed
+  /// Return the time spent in the zone since it was opened [s]
   static double close(bool print = false,
                       int detail_level = -1,
                       std::ostream &out = std::cout);
 
+  /// Close current benchmark and write its content to 'out' with the given format
+  /// detail_level is only used for Text format
+  static double close(Format format,
+                      std::ostream &out = std::cout,
+                      int detail_level = -1);
+
+  /// Return the group of the current zone of the calling thread, which is
+  /// created on first call, or the group to which the thread is attached if
+  /// it has no open zone. Return nullptr if there is neither
+  static std::shared_ptr<WorkerGroup> getWorkerGroup();
+
+  /// Merge the trees of the threads attached to the groups of the current zone
+  /// and its descendants into them. Attached threads should be done with the
+  /// zones of the groups. Throw a runtime_error if there is no current zone
+  static void absorbThreadTrees();
+
+  /// When enabled, the beginning and the end of each call are stored in
+  /// order to export the timeline with the ChromeTrace format. Otherwise,
+  /// calls of a zone appear as a single event lasting the total time.
+  /// Memory used grows with the number of calls while it is enabled
+  static void setTimelineRecording(bool enabled);
+
+  /// When enabled, the duration of each call is stored in a fixed-size
+  /// histogram of the zone with a relative error lower than 3.2%, allowing to
+  /// retrieve percentiles of the latency. Each zone closed while it is
+  /// enabled uses roughly 15kB of memory
+  static void setHistogramRecording(bool enabled);
+
+  /// Return the latencies of the zone at 'path' relative to the current zone
+  /// of this thread, names of the zones in path are separated by '/', an
+  /// empty path designates the current zone itself
+  /// Throw a runtime_error if there is no such zone or if no histogram was
+  /// recorded for it
+  static Latencies getLatencies(const std::string & path = "");
+
+  /// When enabled, the performance counters of the thread (see PerfCounters)
+  /// are read at the opening and the closing of each zone and their
+  /// differences are accumulated and printed. Each zone then requires two
+  /// additional system calls. Counters which are not permitted are ignored,
+  /// calls during which counters were multiplexed are scaled and reported
+  /// Return true if hardware counters are available for the calling thread,
+  /// false if only software counters or timing are available
+  static bool setCounterRecording(bool enabled);
+
+  /// Choose the clock used for measuring zones, it cannot be changed while
+  /// zones are open. If TSC is requested but not reliable on this processor,
+  /// Steady is used instead and false is returned.
+  /// The clock is read by all threads without synchronization other than
+  /// atomic loads: it should be chosen at startup, before other threads use
+  /// Benchmark, otherwise zones opened during the change are meaningless
+  static bool setClock(Clock clock);
+
+  static Clock getClock();
+
+  /// Average cost of reading the given clock [s], measured on 'nb_samples' reads
+  static double measureClockOverhead(Clock clock, int nb_samples = 1000000);
+
+  /// Write the cost of each available clock per read and per zone
+  static void printClockOverheads(std::ostream & out = std::cout);
+
 private:  
+  /// Open a zone, see open and openStatic
+  static void openZone(const char * benchmark_name, bool is_static);
+
+  /// Beginning and end of a call of the zone [ticks]
+  struct Session
+  {
+    uint64_t start;
+    uint64_t end;
+    std::thread::id thread_id;
+  };
+
+  /// Read the current clock
+  static inline uint64_t getTicks()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+      if (clock.load(std::memory_order_relaxed) == Clock::TSC) return __rdtsc();
+#endif
+      return std::chrono::steady_clock::now().time_since_epoch().count();
+    }
+
+  /// Copy the trees of all threads having open zones. Return a zone without
+  /// time whose children are the roots of all threads, merged by name
+  static std::shared_ptr<Benchmark> takeSnapshot();
+
+  /// Return a copy of the zone and its children, the zone should not be
+  /// modified by other threads
+  std::shared_ptr<Benchmark> clone() const;
+
+  /// Return a copy of the zone and its children while their threads might
+  /// still be running, the trees of the worker groups are merged in the copy.
+  /// The time elapsed until 'now' is added to the zones in 'open_zones'.
+  /// structure_mutex should be held
+  std::shared_ptr<Benchmark> copyLive(const std::vector<const Benchmark *> & open_zones,
+                                      uint64_t now) const;
+
+  /// Copy the statistics of the zone, which might be modified meanwhile by
+  /// the thread owning it
+  void copyLiveStats(Benchmark & copy) const;
+
+  /// Mark the beginning and the end of a modification of the statistics by
+  /// the thread owning the zone, see sequence
+  inline void beginUpdate()
+    {
+      sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+    }
+  inline void endUpdate()
+    {
+      sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+  /// Remove the times, calls and counters of 'previous', an older copy of
+  /// this zone, children are matched by name. Shortest and longest calls are
+  /// estimated from the histogram or unknown (NaN) if there is none
+  void subtract(const Benchmark & previous);
+
+  /// Return true if the zone has a known shortest and longest call
+  bool hasExtrema() const;
+
+  /// Return true if the processor has an invariant TSC
+  static bool hasInvariantTSC();
+
+  /// Compute the duration of a TSC tick using steady_clock as reference
+  static double calibrateTSC();
+
+  /// Write the whole tree as a Chrome Trace Event JSON object
+  void exportChromeTrace(std::ostream & out) const;
+  /// Write the events of the zone and its children, 'start' is the beginning
+  /// [us] used if the calls of the zone were not recorded
+  void exportChromeEvents(std::ostream & out,
+                          std::vector<std::thread::id> & threads,
+                          bool & first_event,
+                          double start) const;
+
+  /// Write the folded stacks of the zone and its children
+  void exportFoldedStacks(std::ostream & out, const std::string & prefix = "") const;
+
   /// Print until max_depth has been reached, if max_depth is -1, then there is no limits
   void print(std::ostream & out, int max_depth = -1);
   /// Print from current depth to max_depth
@@ -38,29 +335,194 @@ private:
   void startSession();
   void endSession();
 
+  /// Total time spent in the zone over all calls [s]
   double getTime() const;
   double getSubTime() const;
 
+  /// Number of times the zone has been opened
+  int getNbCalls() const;
+  /// Percentiles of the calls, require the histogram to be recorded
+  Latencies computeLatencies() const;
+  /// Shortest call [s]
+  double getMinTime() const;
+  /// Longest call [s]
+  double getMaxTime() const;
+  /// Average duration of a call [s]
+  double getMeanTime() const;
+
+  /// Convert a number of ticks to seconds
+  static double ticksToSec(double ticks);
+
+  /// Return the child with the given name, nullptr if there is none
+  Benchmark * getChild(const char * name) const;
+
+  /// Add the times and the children of 'other' to this zone, children with
+  /// the same name are merged recursively
+  void merge(const Benchmark & other);
+
+  /// Add 'id' to the threads which contributed to the zone if it is not already present
+  void addThreadId(const std::thread::id & id);
+
+  /// Merge 'other' in the child with the same name, create it if necessary
+  void mergeChild(const Benchmark & other);
+
+  /// Merge into 'zone' and its descendants the trees of the threads attached
+  /// to their groups, the trees are then reset
+  static void absorbThreadTrees(Benchmark * zone);
+
+  /// Remove the times, calls and counters of the zone and its children, the
+  /// zones themselves are kept for later calls
+  void reset();
+
+  /// Return the tree of the calling thread for 'group', registering a new
+  /// one in the group on first attachment
+  static Benchmark * getAttachedTree(const std::shared_ptr<WorkerGroup> & group);
+
   /// Create a Benchmark if no benchmark is open
-  static std::shared_ptr<Benchmark> getCurrent();
+  static Benchmark * getCurrent();
+
+  /// Change the current zone of the calling thread
+  static inline void setCurrent(Benchmark * zone)
+    {
+      current = zone;
+      thread_state->current.store(zone, std::memory_order_release);
+    }
+
+  /// Register the calling thread for snapshots
+  static void registerThread();
+
+  /// Trees of a thread, shared with the reporter
+  struct ThreadState
+  {
+    ThreadState() : current(nullptr) {}
+
+    /// Root zone of the thread, owns the whole tree of the thread. It is kept
+    /// after being closed in order to be reused by the next root zone.
+    /// It is only replaced while holding structure_mutex
+    std::shared_ptr<Benchmark> root;
+    /// Copy of current for other threads
+    std::atomic<Benchmark *> current;
+  };
+
+  /// Current level of benchmark of each thread for static access
+  static thread_local Benchmark * current;
+  /// State of each thread, created when the thread opens its first zone
+  static thread_local std::shared_ptr<ThreadState> thread_state;
+  /// States of all the threads which have opened zones, protected by
+  /// structure_mutex
+  static std::vector<std::weak_ptr<ThreadState>> thread_states;
+  /// Held while adding zones to a tree, removing zones from it or merging
+  /// trees, and while the reporter copies the trees. Zones are never
+  /// allocated in steady state, thus it is rarely locked by instrumented
+  /// threads. It is recursive since merging trees resets them
+  static std::recursive_mutex structure_mutex;
+
+  /// Group to which the thread is attached, nullptr if it is not attached
+  static thread_local std::shared_ptr<WorkerGroup> attached_group;
+  /// Tree of the thread in attached_group, its children are the root zones
+  /// opened by the thread while attached
+  static thread_local Benchmark * attached_tree;
 
-  /// Current level of benchmark for static access
-  static std::shared_ptr<Benchmark> current;
+  /// Tree of the thread for a group it has been attached to
+  struct AttachedTree
+  {
+    /// Allows to detect groups which do not exist anymore
+    std::weak_ptr<WorkerGroup> group;
+    const WorkerGroup * group_address;
+    /// Owned by the group
+    Benchmark * tree;
+  };
+  /// Trees of the calling thread in the groups it has been attached to, a
+  /// thread repeatedly attached to a group always uses the same tree
+  static thread_local std::vector<AttachedTree> attached_trees;
+
+  /// Are sessions recorded
+  static std::atomic<bool> record_timeline;
+  /// Are durations of calls stored in histograms
+  static std::atomic<bool> record_histograms;
+  /// Are performance counters read when opening and closing zones
+  static std::atomic<bool> record_counters;
+
+  /// Performance counters of the thread, opened on first use
+  static thread_local std::unique_ptr<PerfCounters> thread_counters;
+  /// Return the counters of the calling thread, opening them if required
+  static PerfCounters & getThreadCounters();
+
+  /// Clock currently used
+  static std::atomic<Clock> clock;
+  /// Duration of a tick of the current clock [s]
+  static std::atomic<double> seconds_per_tick;
+  /// Serializes the calls to setClock
+  static std::mutex clock_mutex;
+
+  /// Number of threads having at least one open zone
+  static std::atomic<int> nb_open_roots;
 
   /// Access to the calling benchmark, pointer is null if there is no father
-  std::shared_ptr<Benchmark> father;
+  Benchmark * father;
 
   /// Name of the current benchmark zone
   std::string name;
+  /// Address of the name provided to openStatic, nullptr otherwise
+  const char * static_name;
 
-  /// When did we enter the zone
-  TimeStamp opening_time;
-  /// When did we leave the zone
-  TimeStamp closing_time;
+  /// Thread which opened the zone
+  std::thread::id thread_id;
+
+  /// Odd while the thread owning the zone modifies the statistics below, the
+  /// reporter copies them again if it changed during the copy. Statistics are
+  /// atomics only to allow these concurrent reads, they are never modified by
+  /// more than one thread at a time
+  std::atomic<uint32_t> sequence;
+
+  /// When did we enter the zone [ticks]
+  std::atomic<uint64_t> opening_ticks;
+  /// When did we leave the zone [ticks]
+  uint64_t closing_ticks;
   /// How much ticks were spent in the zone
-  double elapsed_ticks;
-  /// Storing all the children
+  std::atomic<double> elapsed_ticks;
+  /// How much ticks were spent in the zone during last call
+  double last_ticks;
+  /// Shortest and longest calls [ticks]
+  std::atomic<double> min_ticks;
+  std::atomic<double> max_ticks;
+  /// Number of times the zone has been opened and closed
+  std::atomic<int> nb_calls;
+  /// Value of the performance counters when the zone was opened
+  PerfCounters::Reading opening_counters;
+  /// Is the current call measuring performance counters
+  bool is_counting;
+  /// Sum of the performance counters over all the calls
+  std::array<std::atomic<uint64_t>, PerfCounters::NbCounters> counters;
+  /// Bit i is set if counter i was available in at least one call
+  std::atomic<unsigned int> counters_mask;
+  /// Number of calls for which counters were multiplexed, their values are
+  /// then scaled estimations
+  std::atomic<int> nb_scaled_calls;
+  /// Calls of the zone, only filled while timeline recording is enabled
+  std::vector<Session> sessions;
+  /// Durations of the calls [ticks], only allocated once histogram
+  /// recording has been enabled, while holding structure_mutex
+  std::unique_ptr<LatencyHistogram> histogram;
+  /// Threads which contributed to the zone, only filled for merged zones,
+  /// modified while holding structure_mutex
+  std::vector<std::thread::id> thread_ids;
+  /// Threads working on behalf of this zone, created on first request while
+  /// holding structure_mutex
+  std::shared_ptr<WorkerGroup> worker_group;
+  /// Storing all the children, modified while holding structure_mutex
   std::vector<std::shared_ptr<Benchmark>> children;
 };
 
 }
+
+/// Open a zone until the end of the current scope, compiled out if
+/// ROSBAN_UTILS_DISABLE_BENCHMARK is defined
+#ifdef ROSBAN_UTILS_DISABLE_BENCHMARK
+#define ROSBAN_UTILS_BENCHMARK_SCOPE(name)
+#else
+#define ROSBAN_UTILS_BENCHMARK_CONCAT_(a, b) a##b
+#define ROSBAN_UTILS_BENCHMARK_CONCAT(a, b) ROSBAN_UTILS_BENCHMARK_CONCAT_(a, b)
+#define ROSBAN_UTILS_BENCHMARK_SCOPE(name)                              \
+  rosban_utils::Benchmark::Scope ROSBAN_UTILS_BENCHMARK_CONCAT(benchmark_scope_, __LINE__)(name)
+#endif
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "rosban_utils/io_tools.h"
+
+#include <cstdint>
+#include <ostream>
+#include <streambuf>
+#include <vector>
+
+namespace rosban_utils
+{
+
+/// Compression applied to serialized data
+enum class Compression
+{
+  None,
+  /// Fast LZ77 compression using the LZ4 block format, independent blocks
+  /// of LZ_BLOCK_SIZE bytes are compressed separately
+  LZ
+};
+
+/// Size of the blocks of uncompressed data [bytes]
+const size_t LZ_BLOCK_SIZE = 1 << 20;
+
+/// Maximal size of the compressed version of 'size' bytes
+size_t lzCompressBound(size_t size);
+
+/// Compress 'size' bytes from 'src' into 'dst' which should be able to hold
+/// lzCompressBound(size) bytes, return the size of the compressed data
+size_t lzCompress(const char * src, size_t size, char * dst);
+
+/// Decompress 'compressed_size' bytes from 'src' into 'dst' which should
+/// contain exactly 'raw_size' bytes once decompressed. Throw a runtime_error
+/// if data is corrupted
+void lzDecompress(const char * src, size_t compressed_size, char * dst, size_t raw_size);
+
+/// Return true if the data starts with the header written by LZOutputBuffer
+bool isLZCompressed(const char * data, size_t size);
+
+/// Stream buffer compressing the data written to it by blocks and sending
+/// them to 'out'. Format is:
+/// - magic "RBLZ" and version (int)
+/// - blocks: compressed size (uint32_t), raw size (uint32_t) and data. If the
+///   highest bit of compressed size is set, data is stored uncompressed
+/// - end marker: a block with a raw size of 0
+/// The end marker is written by close, which is called on destruction
+class LZOutputBuffer : public std::streambuf
+{
+public:
+  LZOutputBuffer(std::ostream & out);
+  ~LZOutputBuffer();
+
+  /// Compress remaining data and write end marker, throw a runtime_error if
+  /// writing fails
+  void close();
+
+  /// Number of compressed bytes written to out
+  size_t getNbCompressedBytes() const;
+
+protected:
+  int_type overflow(int_type c) override;
+  std::streamsize xsputn(const char * s, std::streamsize n) override;
+
+private:
+  /// Compress the content of block and send it
+  void writeBlock();
+
+  std::ostream & out;
+  /// Uncompressed data waiting to be compressed
+  std::vector<char> block;
+  size_t block_used;
+  /// Space used to compress
+  std::vector<char> compressed;
+  size_t nb_compressed_bytes;
+  bool is_closed;
+};
+
+/// Stream buffer providing the decompressed content of data written by
+/// LZOutputBuffer and read from 'in'. Throw a runtime_error if data is not
+/// compressed or corrupted
+class LZInputBuffer : public std::streambuf
+{
+public:
+  LZInputBuffer(BinaryReader & in);
+
+protected:
+  int_type underflow() override;
+
+private:
+  /// Decompress next block, return false if the end marker has been reached
+  bool readBlock();
+
+  BinaryReader & in;
+  /// Decompressed data of the current block
+  std::vector<char> block;
+  /// Used if compressed data cannot be accessed directly from the reader
+  std::vector<char> compressed;
+  bool is_finished;
+};
+
+}
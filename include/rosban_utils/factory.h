@@ -1,13 +1,16 @@
 #pragma once
 
 #include "rosban_utils/io_tools.h"
+#include "rosban_utils/mapped_file.h"
 #include "rosban_utils/serializable.h"
+#include "rosban_utils/stream_serializable.h"
 
 #include <fstream>
 #include <functional>
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 
 namespace rosban_utils
 {
@@ -185,18 +188,53 @@ public:
       return bytes_read;
     }
 
+  /// Read from a buffered reader, T should inherit from StreamSerializable
+  /// Return the number of bytes read
+  int read(BinaryReader & in, std::unique_ptr<T> & ptr)
+    {
+      int bytes_read = 0;
+      int id;
+      bytes_read += rosban_utils::read<int>(in, &id);
+      // Objects built by default can read directly from the buffered reader
+      if (default_stream_builders.count(id) != 0) {
+        ptr = getBuilder(id)();
+        bytes_read += static_cast<StreamSerializable &>(*ptr).read(in);
+        return bytes_read;
+      }
+      // Custom stream builders require a std::istream
+      BinaryReaderBuffer buffer(in);
+      std::istream stream(&buffer);
+      stream.exceptions(std::ios::badbit);
+      int builder_bytes_read = 0;
+      ptr = getStreamBuilder(id)(stream, &builder_bytes_read);
+      bytes_read += builder_bytes_read;
+      return bytes_read;
+    }
+
+  /// The file is mapped in memory and read without copy when possible,
+  /// compressed files are detected and decompressed on the fly
   /// Return the number of bytes read
   int loadFromFile(const std::string & filename, std::unique_ptr<T> & ptr)
     {
-      std::ifstream in(filename, std::ios::binary);
-      if (!in) {
+      std::shared_ptr<MappedFile> file;
+      try {
+        file.reset(new MappedFile(filename));
+      }
+      catch (const std::runtime_error & exc) {
         std::ostringstream oss;
-        oss << "Failed to open '" << filename << "' for binary reading";
+        oss << "Failed to open '" << filename << "' for binary reading: " << exc.what();
         throw std::runtime_error(oss.str());
       }
-      int bytes_read = read(in, ptr);
-      in.close();
-      return bytes_read;
+      BinaryReader reader(file);
+      if (isLZCompressed(file->getData(), file->getSize())) {
+        LZInputBuffer buffer(reader);
+        std::istream stream(&buffer);
+        // Decompression errors are rethrown to the reader
+        stream.exceptions(std::ios::badbit);
+        BinaryReader decompressed(stream);
+        return read(decompressed, ptr);
+      }
+      return read(reader, ptr);
     }
 
   /// Fill 'ptr' with a generated object with the given node as argument
@@ -263,6 +301,7 @@ public:
     {
       if (autocreate_streambuilder) {
         registerBuilder(id, toStreamBuilder(builder));
+        default_stream_builders.insert(id);
       }
       if (builders_by_id.count(id) != 0) {
         std::ostringstream oss;
@@ -311,6 +350,8 @@ private:
   std::unordered_map<int, Builder>  builders_by_id;
   /// Contains a mapping from class names to builders
   std::unordered_map<int, StreamBuilder>  stream_builders_by_id;
+  /// Ids for which the stream builder only calls read on a default object
+  std::unordered_set<int> default_stream_builders;
 };
 
 }
@@ -1,11 +1,20 @@
 #pragma once
 
+#include <Eigen/Core>
+
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <streambuf>
 #include <string>
+#include <vector>
 
 namespace rosban_utils
 {
 
+class MappedFile;
+
 /// Return the content of the whole file as a string
 std::string file2string(const std::string &path);
 
@@ -74,4 +83,467 @@ T read(std::istream & in)
   return obj;
 }
 
+/// Write binary data to a large contiguous buffer which is flushed to the
+/// output stream only when full, thus writing a value does not require any
+/// virtual call. If no stream is provided, data is kept in memory.
+/// The buffer is flushed on destruction, call flush to handle errors.
+class BinaryWriter
+{
+public:
+  /// Write to a memory buffer growing as required
+  BinaryWriter();
+  /// Write to 'out' by blocks of 'buffer_size' bytes
+  BinaryWriter(std::ostream & out, size_t buffer_size = 1 << 16);
+  /// Write directly to the 'size' bytes starting at 'data', which are not
+  /// owned by the writer. Writing beyond the end throws a runtime_error
+  BinaryWriter(char * data, size_t size);
+  ~BinaryWriter();
+
+  BinaryWriter(const BinaryWriter & other) = delete;
+  BinaryWriter & operator=(const BinaryWriter & other) = delete;
+
+  /// Return the number of bytes written
+  template <typename T>
+  inline int write(const T & val)
+    {
+      if (capacity - used < sizeof(T)) makeRoom(sizeof(T));
+      std::memcpy(begin + used, &val, sizeof(T));
+      used += sizeof(T);
+      return sizeof(T);
+    }
+
+  /// Return the number of bytes written
+  template <typename T>
+  inline int writeArray(const T * values, int nb_values)
+    {
+      return writeRaw(reinterpret_cast<const char *>(values), nb_values * sizeof(T));
+    }
+
+  /// Return the number of bytes written
+  inline int writeRaw(const char * data, size_t nb_bytes)
+    {
+      // Empty arrays might have a null pointer
+      if (nb_bytes == 0) return 0;
+      if (capacity - used < nb_bytes) return writeLarge(data, nb_bytes);
+      std::memcpy(begin + used, data, nb_bytes);
+      used += nb_bytes;
+      return nb_bytes;
+    }
+
+  /// Send the content of the buffer to the stream, nothing is done if there
+  /// is no stream. Throw a runtime_error if the stream fails
+  void flush();
+
+  /// Discard the data which has not been flushed, allows to reuse the memory
+  /// of a writer without stream
+  void clear();
+
+  /// Data which has not been flushed yet, the whole content if there is no stream
+  const char * getData() const;
+  size_t getSize() const;
+
+  /// Total number of bytes written since creation
+  size_t getNbBytesWritten() const;
+
+private:
+  /// Ensure that 'nb_bytes' can be written in the buffer
+  void makeRoom(size_t nb_bytes);
+
+  /// Write data which does not fit in the buffer
+  int writeLarge(const char * data, size_t nb_bytes);
+
+  /// Stream to which data is flushed, nullptr for memory buffers
+  std::ostream * out;
+  /// Storage of the buffer, empty when writing to external memory
+  std::vector<char> buffer;
+  /// Start and size of the memory currently used as buffer
+  char * begin;
+  size_t capacity;
+  /// Is the writer restricted to external memory
+  bool is_fixed;
+  /// Number of bytes used in buffer
+  size_t used;
+  /// Number of bytes already sent to the stream
+  size_t nb_flushed_bytes;
+};
+
+/// Read binary data from a large contiguous buffer which is filled by blocks
+/// from the input stream. Since data is read ahead, the position of the
+/// stream after reading is undefined. It can also read directly from memory
+/// without any copy.
+/// Reading beyond the end of data throws a runtime_error
+class BinaryReader
+{
+public:
+  /// Read from 'in' by blocks of 'buffer_size' bytes
+  BinaryReader(std::istream & in, size_t buffer_size = 1 << 16);
+  /// Read from memory, 'data' should stay valid while reading
+  BinaryReader(const char * data, size_t size);
+  /// Read from memory owned by 'owner', objects keeping pointers to the data
+  /// can share the ownership through getOwner
+  BinaryReader(const char * data, size_t size, std::shared_ptr<const void> owner);
+  /// Read from a mapped file without copy, pages of large blocks copied with
+  /// readArray are released once read to limit the memory used
+  BinaryReader(std::shared_ptr<const MappedFile> file);
+
+  BinaryReader(const BinaryReader & other) = delete;
+  BinaryReader & operator=(const BinaryReader & other) = delete;
+
+  /// Return the number of bytes read
+  template <typename T>
+  inline int read(T * ptr)
+    {
+      if ((size_t)(end - pos) < sizeof(T)) fill(sizeof(T));
+      std::memcpy(ptr, pos, sizeof(T));
+      pos += sizeof(T);
+      return sizeof(T);
+    }
+
+  template <typename T>
+  inline T read()
+    {
+      T obj;
+      read<T>(&obj);
+      return obj;
+    }
+
+  /// Return the number of bytes read
+  template <typename T>
+  inline int readArray(T * values, int nb_values)
+    {
+      return readRaw(reinterpret_cast<char *>(values), nb_values * sizeof(T));
+    }
+
+  /// Return the number of bytes read
+  inline int readRaw(char * data, size_t nb_bytes)
+    {
+      if (nb_bytes == 0) return 0;
+      if ((size_t)(end - pos) < nb_bytes || nb_bytes >= LARGE_BLOCK_SIZE) {
+        return readLarge(data, nb_bytes);
+      }
+      std::memcpy(data, pos, nb_bytes);
+      pos += nb_bytes;
+      return nb_bytes;
+    }
+
+  /// Return a pointer to the next 'nb_bytes' and consume them. When reading
+  /// from memory, no copy is performed, otherwise the pointer is only valid
+  /// until the next call to the reader
+  const char * getPointer(size_t nb_bytes);
+
+  /// Return a pointer to the next 'nb_values' elements of type T and consume
+  /// them, without any copy. Only available when reading from memory: if the
+  /// reader uses a stream or if the data is not properly aligned for T,
+  /// nothing is consumed and nullptr is returned, readArray should then be used
+  template <typename T>
+  const T * getArray(int nb_values)
+    {
+      if (in || reinterpret_cast<uintptr_t>(pos) % alignof(T) != 0) return nullptr;
+      return reinterpret_cast<const T *>(getPointer(nb_values * sizeof(T)));
+    }
+
+  /// Owner of the memory read, nullptr if there is none or if reading from a
+  /// stream
+  std::shared_ptr<const void> getOwner() const;
+
+  /// Return a pointer to the available data without consuming it, buffer is
+  /// filled if it is empty. 'nb_bytes' is set to the number of bytes
+  /// available, 0 if the end of the data has been reached
+  const char * peek(size_t * nb_bytes);
+
+  /// Consume 'nb_bytes' which have been provided by peek
+  void skip(size_t nb_bytes);
+
+  /// Return true if there is no more data to read
+  bool isEnd();
+
+  /// Total number of bytes read since creation
+  size_t getNbBytesRead() const;
+
+private:
+  /// Ensure that at least 'nb_bytes' are available in the buffer, throw a
+  /// runtime_error if the end of data is reached before
+  void fill(size_t nb_bytes);
+
+  /// Read data larger than the content of the buffer or than LARGE_BLOCK_SIZE
+  int readLarge(char * data, size_t nb_bytes);
+
+  /// Size above which copied blocks of mapped files are released [bytes]
+  static const size_t LARGE_BLOCK_SIZE = 1 << 20;
+
+  /// Stream from which data is read, nullptr for memory readers
+  std::istream * in;
+  std::vector<char> buffer;
+  /// Next byte to read
+  const char * pos;
+  /// End of available data
+  const char * end;
+  /// Number of bytes consumed before the beginning of the data available
+  size_t nb_previous_bytes;
+  /// Beginning of the available data, used to count bytes read
+  const char * start;
+  /// Keeps the memory read alive
+  std::shared_ptr<const void> owner;
+  /// File read if any, nullptr otherwise
+  const MappedFile * mapped_file;
+};
+
+/// Stream buffer writing to a BinaryWriter, allows to use functions based on
+/// std::ostream with a BinaryWriter
+class BinaryWriterBuffer : public std::streambuf
+{
+public:
+  BinaryWriterBuffer(BinaryWriter & writer);
+
+protected:
+  int_type overflow(int_type c) override;
+  std::streamsize xsputn(const char * s, std::streamsize n) override;
+
+private:
+  BinaryWriter & writer;
+};
+
+/// Stream buffer discarding everything, only the number of bytes written is
+/// kept. Allows to compute the size of data written by functions based on
+/// std::ostream
+class CountingBuffer : public std::streambuf
+{
+public:
+  CountingBuffer();
+
+  /// Number of bytes written since creation
+  size_t getCount() const;
+
+protected:
+  int_type overflow(int_type c) override;
+  std::streamsize xsputn(const char * s, std::streamsize n) override;
+
+private:
+  size_t count;
+};
+
+/// Stream buffer reading from a BinaryReader, allows to use functions based on
+/// std::istream with a BinaryReader. The reader only consumes the bytes
+/// extracted from the stream, once the buffer has been synchronized or
+/// destroyed
+class BinaryReaderBuffer : public std::streambuf
+{
+public:
+  BinaryReaderBuffer(BinaryReader & reader);
+  ~BinaryReaderBuffer();
+
+protected:
+  int_type underflow() override;
+  std::streamsize xsgetn(char * s, std::streamsize n) override;
+  int sync() override;
+
+private:
+  BinaryReader & reader;
+};
+
+/// Return the number of bytes written
+template <typename T>
+int write(BinaryWriter & out, const T & val)
+{
+  return out.write<T>(val);
+}
+
+/// Return the number of bytes written
+template <typename T>
+int writeArray(BinaryWriter & out, int nb_values, const T * val)
+{
+  return out.writeArray<T>(val, nb_values);
+}
+
+/// Return the number of bytes written
+inline int writeInt(BinaryWriter & out, int val)
+{
+  return out.write<int>(val);
+}
+/// Return the number of bytes written
+inline int writeDouble(BinaryWriter & out, double val)
+{
+  return out.write<double>(val);
+}
+/// Return the number of bytes written
+inline int writeIntArray(BinaryWriter & out, const int * values, int nb_values)
+{
+  return out.writeArray<int>(values, nb_values);
+}
+/// Return the number of bytes written
+inline int writeDoubleArray(BinaryWriter & out, const double * values, int nb_values)
+{
+  return out.writeArray<double>(values, nb_values);
+}
+
+/// Return the number of bytes read
+inline int readInt(BinaryReader & in, int & val)
+{
+  return in.read<int>(&val);
+}
+/// Return the number of bytes read
+inline int readDouble(BinaryReader & in, double & val)
+{
+  return in.read<double>(&val);
+}
+/// Return the number of bytes read
+inline int readIntArray(BinaryReader & in, int * values, int nb_values)
+{
+  return in.readArray<int>(values, nb_values);
+}
+/// Return the number of bytes read
+inline int readDoubleArray(BinaryReader & in, double * values, int nb_values)
+{
+  return in.readArray<double>(values, nb_values);
+}
+
+/// Return the number of bytes read
+template <typename T>
+int read(BinaryReader & in, T * ptr)
+{
+  return in.read<T>(ptr);
+}
+
+/// Return the number of bytes read
+template <typename T>
+int readArray(BinaryReader & in, int nb_values, T * ptr)
+{
+  return in.readArray<T>(ptr, nb_values);
+}
+
+/// Throw a runtime_error if something goes wrong
+template <typename T>
+T read(BinaryReader & in)
+{
+  return in.read<T>();
+}
+
+/// Eigen matrices and vectors are written as their number of rows and
+/// columns (int) followed by their coefficients in the storage order of the
+/// type (column-major by default), thus they should be read with the same
+/// storage order. Types with a fixed size still write their shape, which is
+/// checked when reading.
+/// Return the number of bytes written
+template <typename Out, typename Scalar, int Rows, int Cols, int Options, int MaxRows, int MaxCols>
+int writeMatrix(Out & out, const Eigen::Matrix<Scalar, Rows, Cols, Options, MaxRows, MaxCols> & m)
+{
+  int bytes_written = 0;
+  bytes_written += write<int>(out, m.rows());
+  bytes_written += write<int>(out, m.cols());
+  bytes_written += writeArray<Scalar>(out, m.size(), m.data());
+  return bytes_written;
+}
+
+/// Read a matrix written by writeMatrix directly in the storage of 'm', the
+/// existing allocation is reused if the shape does not change.
+/// Throw a runtime_error if the shape is not compatible with the type
+/// Return the number of bytes read
+template <typename In, typename Scalar, int Rows, int Cols, int Options, int MaxRows, int MaxCols>
+int readMatrix(In & in, Eigen::Matrix<Scalar, Rows, Cols, Options, MaxRows, MaxCols> * m)
+{
+  typedef Eigen::Matrix<Scalar, Rows, Cols, Options, MaxRows, MaxCols> MatrixType;
+  int bytes_read = 0;
+  int rows, cols;
+  bytes_read += read<int>(in, &rows);
+  bytes_read += read<int>(in, &cols);
+  if (rows < 0 || cols < 0 ||
+      (Rows != Eigen::Dynamic && rows != Rows) || (Cols != Eigen::Dynamic && cols != Cols) ||
+      (MaxRows != Eigen::Dynamic && rows > MaxRows) || (MaxCols != Eigen::Dynamic && cols > MaxCols)) {
+    throw std::runtime_error("readMatrix: invalid shape " + std::to_string(rows) + "x"
+                             + std::to_string(cols) + " for type "
+                             + std::to_string(MatrixType::RowsAtCompileTime) + "x"
+                             + std::to_string(MatrixType::ColsAtCompileTime));
+  }
+  // No allocation if the size does not change
+  m->resize(rows, cols);
+  bytes_read += readArray<Scalar>(in, rows * cols, m->data());
+  return bytes_read;
+}
+
+/// Return the number of bytes written
+template <typename Scalar, int Rows, int Cols, int Options, int MaxRows, int MaxCols>
+int write(std::ostream & out, const Eigen::Matrix<Scalar, Rows, Cols, Options, MaxRows, MaxCols> & m)
+{
+  return writeMatrix(out, m);
+}
+
+/// Return the number of bytes written
+template <typename Scalar, int Rows, int Cols, int Options, int MaxRows, int MaxCols>
+int write(BinaryWriter & out, const Eigen::Matrix<Scalar, Rows, Cols, Options, MaxRows, MaxCols> & m)
+{
+  return writeMatrix(out, m);
+}
+
+/// Return the number of bytes read
+template <typename Scalar, int Rows, int Cols, int Options, int MaxRows, int MaxCols>
+int read(std::istream & in, Eigen::Matrix<Scalar, Rows, Cols, Options, MaxRows, MaxCols> * m)
+{
+  return readMatrix(in, m);
+}
+
+/// Return the number of bytes read
+template <typename Scalar, int Rows, int Cols, int Options, int MaxRows, int MaxCols>
+int read(BinaryReader & in, Eigen::Matrix<Scalar, Rows, Cols, Options, MaxRows, MaxCols> * m)
+{
+  return readMatrix(in, m);
+}
+
+/// Write the number of vectors (int), their dimension (int) and all their
+/// coefficients in a single block. If dimensions differ, -1 is written as
+/// dimension and followed by the dimension of each vector.
+/// Return the number of bytes written
+int writeVectors(BinaryWriter & out, const std::vector<Eigen::VectorXd> & vectors);
+/// Same as above, data is gathered before being sent to the stream
+int writeVectors(std::ostream & out, const std::vector<Eigen::VectorXd> & vectors);
+
+/// Read vectors written by writeVectors, existing vectors with the right
+/// dimension are reused without allocation
+/// Return the number of bytes read
+int readVectors(BinaryReader & in, std::vector<Eigen::VectorXd> * vectors);
+int readVectors(std::istream & in, std::vector<Eigen::VectorXd> * vectors);
+
+/// Compact encodings of arrays, as an opt-in alternative to writeIntArray and
+/// writeDoubleArray. As for the raw versions, the number of values is not
+/// written and should be known by the reader. Encoded data is preceded by its
+/// size in bytes (int), thus readers from std::istream do not read beyond it.
+/// Decoding throws a runtime_error if the data is not consistent with the
+/// number of values.
+///
+/// - VarInt: zig-zag encoding followed by 1 to 5 bytes per value, small
+///   absolute values use a single byte
+/// - DeltaInt: VarInt encoding of the differences between consecutive values,
+///   suited to sorted or slowly changing values
+/// - XorDouble: lossless, each value is XORed with the previous one and only
+///   the non-zero bytes of the result are written after a control byte,
+///   suited to slowly changing series
+/// - QuantizedDouble: lossy, values are rounded to multiples of
+///   2 * tolerance and the multiples are encoded with DeltaInt, the error
+///   on each value is at most 'tolerance' (up to floating point rounding)
+///
+/// All functions return the number of bytes written or read
+
+int writeVarIntArray(BinaryWriter & out, const int * values, int nb_values);
+int writeVarIntArray(std::ostream & out, const int * values, int nb_values);
+int readVarIntArray(BinaryReader & in, int * values, int nb_values);
+int readVarIntArray(std::istream & in, int * values, int nb_values);
+
+int writeDeltaIntArray(BinaryWriter & out, const int * values, int nb_values);
+int writeDeltaIntArray(std::ostream & out, const int * values, int nb_values);
+int readDeltaIntArray(BinaryReader & in, int * values, int nb_values);
+int readDeltaIntArray(std::istream & in, int * values, int nb_values);
+
+int writeXorDoubleArray(BinaryWriter & out, const double * values, int nb_values);
+int writeXorDoubleArray(std::ostream & out, const double * values, int nb_values);
+int readXorDoubleArray(BinaryReader & in, double * values, int nb_values);
+int readXorDoubleArray(std::istream & in, double * values, int nb_values);
+
+/// Throw a logic_error if tolerance is not strictly positive and a
+/// runtime_error if a value is not finite or too large for the tolerance
+int writeQuantizedDoubleArray(BinaryWriter & out, const double * values, int nb_values,
+                              double tolerance);
+int writeQuantizedDoubleArray(std::ostream & out, const double * values, int nb_values,
+                              double tolerance);
+int readQuantizedDoubleArray(BinaryReader & in, double * values, int nb_values);
+int readQuantizedDoubleArray(std::istream & in, double * values, int nb_values);
+
 }
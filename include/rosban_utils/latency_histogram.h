@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace rosban_utils
+{
+
+/// A histogram with logarithmic buckets, used to store a large number of
+/// durations with a fixed memory and a bounded relative error (HDR-style).
+/// Values are split according to their highest bit, then each power of 2 is
+/// divided in 2^SUB_BUCKETS_BITS linear sub-buckets, thus the relative error
+/// on percentiles is lower than 2^-SUB_BUCKETS_BITS
+///
+/// Values should be recorded by a single thread, but other threads can read
+/// the histogram (e.g. merge it into their own) while values are recorded:
+/// they then obtain an approximation of its content, since values recorded
+/// during the read might only be partially visible
+class LatencyHistogram
+{
+public:
+  LatencyHistogram();
+
+  /// Add a value in constant time
+  inline void record(uint64_t value)
+    {
+      // Single writer: no read-modify-write is required
+      std::atomic<uint64_t> & count = counts[getBucket(value)];
+      count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      uint64_t nb = nb_values.load(std::memory_order_relaxed);
+      if (nb == 0 || value < min_value.load(std::memory_order_relaxed)) {
+        min_value.store(value, std::memory_order_relaxed);
+      }
+      if (value > max_value.load(std::memory_order_relaxed)) {
+        max_value.store(value, std::memory_order_relaxed);
+      }
+      nb_values.store(nb + 1, std::memory_order_relaxed);
+    }
+
+  /// Add all the values of 'other' to this histogram
+  void merge(const LatencyHistogram & other);
+
+  /// Remove the values of 'other', which should have been recorded before in
+  /// this histogram, e.g. to obtain the values recorded since a copy was made.
+  /// Min and max are then approximated by the bounds of the buckets
+  void subtract(const LatencyHistogram & other);
+
+  /// Remove all values
+  void reset();
+
+  uint64_t getNbValues() const;
+  uint64_t getMin() const;
+  uint64_t getMax() const;
+
+  /// Return an upper bound of the value under which 'percentile' percents
+  /// of the values are, 'percentile' is in [0,100]
+  uint64_t getPercentile(double percentile) const;
+
+private:
+  /// Bucket used to store 'value'
+  static inline int getBucket(uint64_t value)
+    {
+      if (value < NB_SUB_BUCKETS) return value;
+      int msb = 63 - __builtin_clzll(value);
+      int shift = msb - SUB_BUCKETS_BITS;
+      int sub_bucket = (value >> shift) - NB_SUB_BUCKETS;
+      return (shift + 1) * NB_SUB_BUCKETS + sub_bucket;
+    }
+
+  /// Lowest value stored in the given bucket
+  static uint64_t getBucketMin(int bucket);
+  /// Highest value stored in the given bucket
+  static uint64_t getBucketMax(int bucket);
+
+  static const int SUB_BUCKETS_BITS = 5;
+  static const int NB_SUB_BUCKETS = 1 << SUB_BUCKETS_BITS;
+  /// Values up to 2^64 can be represented
+  static const int NB_BUCKETS = (64 - SUB_BUCKETS_BITS + 1) * NB_SUB_BUCKETS;
+
+  std::vector<std::atomic<uint64_t>> counts;
+  std::atomic<uint64_t> nb_values;
+  std::atomic<uint64_t> min_value;
+  std::atomic<uint64_t> max_value;
+};
+
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+
+namespace rosban_utils
+{
+
+/// Read-only memory mapping of a whole file, allowing to read its content
+/// without copying it through a stream buffer. Pages are only loaded when
+/// they are accessed and can be reclaimed by the kernel at any time.
+class MappedFile
+{
+public:
+  /// Expected access pattern, used as a hint for the kernel
+  enum class Access
+  {
+    /// Aggressive read-ahead, pages are freed soon after being read
+    Sequential,
+    /// No read-ahead
+    Random
+  };
+
+  /// Map the file at 'path', throw a runtime_error on failure
+  MappedFile(const std::string & path, Access access = Access::Sequential);
+  ~MappedFile();
+
+  MappedFile(const MappedFile & other) = delete;
+  MappedFile & operator=(const MappedFile & other) = delete;
+
+  /// Beginning of the file content, nullptr for empty files
+  const char * getData() const;
+  size_t getSize() const;
+
+  /// Change the access pattern hint for the given range of the file
+  void advise(size_t offset, size_t length, Access access) const;
+
+  /// Tell the kernel that the pages fully included in the given range are
+  /// not needed anymore, reducing the memory used. They are read again from
+  /// the file if they are accessed later
+  void release(size_t offset, size_t length) const;
+
+private:
+  const char * data;
+  size_t size;
+};
+
+}
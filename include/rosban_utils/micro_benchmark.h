@@ -0,0 +1,110 @@
+#pragma once
+
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace rosban_utils
+{
+
+/// Run small pieces of code many times in order to obtain statistically
+/// meaningful timings. Each run is composed of a warmup, a calibration of the
+/// number of iterations to reach a target time per repetition and several
+/// repetitions. Every repetition is measured as a Benchmark zone named after
+/// the task, so runs also appear in the tree of the surrounding zone.
+/// Results can be saved as a baseline and later runs compared to it.
+class MicroBenchmark
+{
+public:
+  typedef std::function<void()> Task;
+
+  struct Config
+  {
+    Config();
+
+    /// Time spent running the task before measuring [s]
+    double warmup_time;
+    /// Minimal duration of a repetition, used to choose the number of iterations [s]
+    double target_time;
+    /// Number of measured repetitions, at least 2
+    int nb_repetitions;
+    /// Relative slowdown above which a result is considered as a regression
+    /// if the confidence intervals do not overlap
+    double regression_threshold;
+  };
+
+  /// Statistics on the duration of a single iteration of the task [s]
+  struct Result
+  {
+    std::string name;
+    int nb_iterations;
+    int nb_repetitions;
+    double mean;
+    double median;
+    double stddev;
+    double min;
+    double max;
+    /// 95% confidence interval of the mean
+    double ci_low;
+    double ci_high;
+  };
+
+  /// Status of a result with respect to the baseline
+  enum class Status
+  {
+    Unchanged,
+    Regression,
+    Improvement,
+    /// No result with this name in the baseline
+    New
+  };
+
+  MicroBenchmark(const Config & config = Config());
+
+  /// Run the task with the given name and store the result
+  const Result & run(const std::string & name, Task task);
+
+  const std::vector<Result> & getResults() const;
+
+  /// Write one line per result
+  void print(std::ostream & out = std::cout) const;
+
+  /// Save the results to a text file, throw a runtime_error on failure
+  void saveBaseline(const std::string & path) const;
+
+  /// Read results previously saved with saveBaseline
+  static std::vector<Result> loadBaseline(const std::string & path);
+
+  /// Compare 'result' to the result with the same name in 'baseline'
+  Status compare(const Result & result, const std::vector<Result> & baseline) const;
+
+  /// Compare all the results to the baseline stored at 'path', write one line
+  /// per result and return the number of regressions
+  int compareToBaseline(const std::string & path, std::ostream & out = std::cout) const;
+
+  /// Prevent the compiler from optimizing out the computation of 'value'
+  template <typename T>
+  static void doNotOptimize(const T & value)
+    {
+      asm volatile("" : : "g"(&value) : "memory");
+    }
+
+private:
+  /// Run 'nb_iterations' of the task inside a Benchmark zone and return the
+  /// time spent [s]
+  static double measure(const std::string & name, Task & task, int nb_iterations);
+
+  /// Compute the statistics of the durations of an iteration
+  static Result computeStats(const std::string & name, int nb_iterations,
+                             std::vector<double> durations);
+
+  /// Quantile of the Student t distribution used for 95% confidence intervals
+  static double getStudentQuantile(int degrees_of_freedom);
+
+  Config config;
+
+  std::vector<Result> results;
+};
+
+}
@@ -1,7 +1,22 @@
 #pragma once
 
+#include "rosban_utils/time_stamp.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
 #include <functional>
+#include <future>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <ostream>
 #include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -18,7 +33,320 @@ public:
   typedef std::function<void(int start_idx,
                              int end_idx,
                              std::default_random_engine * engine)> StochasticTask;
-  
+  /// Task processing the box [start[0],end[0][ x ... x [start[n-1],end[n-1][
+  typedef std::function<void(const std::vector<int> & start_idx,
+                             const std::vector<int> & end_idx)> TileTask;
+  class CancellationToken;
+
+  /// Task receiving the token of the run, long tasks can check it to abort
+  /// early. It returns the index reached: only the tasks in
+  /// [start_idx, returned index[ are considered as processed, a task
+  /// running until the end of its interval returns end_idx
+  typedef std::function<int(int start_idx,
+                            int end_idx,
+                            const CancellationToken & token)> CancellableTask;
+
+  /// Random engine of a single task: the splitmix64 generator, whose state is
+  /// a 64 bits counter initialized with the seed of the task. Seeding is free
+  /// and the streams of the tasks start at decorrelated points of a period of
+  /// 2^64, unlike 32 bits engines where streams of many tasks overlap.
+  /// It can be used with the standard distributions
+  class TaskEngine
+  {
+  public:
+    typedef uint64_t result_type;
+
+    explicit TaskEngine(uint64_t seed_value = 0) : state(seed_value) {}
+
+    void seed(uint64_t seed_value) { state = seed_value; }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<uint64_t>::max(); }
+
+    inline result_type operator()()
+      {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+      }
+
+  private:
+    uint64_t state;
+  };
+
+  /// Task processing a single index with an engine dedicated to this index
+  typedef std::function<void(int task_idx, TaskEngine * engine)> SeededTask;
+
+  /// A set of long-lived worker threads used to avoid creating and joining
+  /// threads at each call of runParallelTask
+  class Pool
+  {
+  public:
+    /// A job receives the index of the job to run, in [0,nb_jobs[
+    typedef std::function<void(int job_idx)> Job;
+
+    /// Describe on which cores the workers of the pool are run
+    struct Placement
+    {
+      enum class Type
+      {
+        /// Workers are not pinned and jobs are taken by the first available thread
+        None,
+        /// Workers are pinned to consecutive cores, filling a socket before the next one
+        Compact,
+        /// Workers are pinned in a round-robin manner on the different sockets
+        Scatter,
+        /// Worker 'i' is pinned to cores[i % cores.size()]
+        Explicit
+      };
+
+      Placement(Type type = Type::None,
+                const std::vector<int> & cores = std::vector<int>());
+
+      Type type;
+      /// Only used for Explicit placement
+      std::vector<int> cores;
+    };
+
+    /// Create a pool able to run 'nb_threads' jobs at the same time, the
+    /// thread calling 'run' is used as one of the threads
+    Pool(int nb_threads = 1);
+    ~Pool();
+
+    Pool(const Pool & other) = delete;
+    Pool & operator=(const Pool & other) = delete;
+
+    /// Number of threads available including the calling thread
+    int getNbThreads() const;
+
+    /// Ensure that at least 'nb_threads' can run in parallel, cannot be
+    /// called from a job of this pool
+    void reserve(int nb_threads);
+
+    /// Run 'job' for all values in [0,nb_jobs[ and wait until all of them are finished
+    /// - If a job throws an exception, the first exception is rethrown once
+    ///   all jobs have been processed
+    /// - If the pool is already running (concurrent or nested call), jobs are
+    ///   run on freshly created threads instead
+    void run(int nb_jobs, const Job & job);
+
+    /// Pin the workers according to 'placement'. When workers are pinned,
+    /// job 'i' is always run by worker 'i' and the calling thread only waits,
+    /// thus a given interval of a static schedule is always processed on the
+    /// same core, which helps keeping data local to a NUMA node.
+    /// Pinning is only available on Linux, on other systems only the job
+    /// assignment is modified
+    void setPlacement(const Placement & placement);
+
+    /// Return the cores used by workers, in the order of the workers, empty
+    /// if placement is None
+    const std::vector<int> & getCores() const;
+
+    /// Return the cores on which the current process is allowed to run,
+    /// ordered according to 'type' (Compact or Scatter)
+    static std::vector<int> getAvailableCores(Placement::Type type);
+
+    /// Access to the process-wide pool used by the static methods of MultiCore
+    static Pool & getInstance();
+
+  private:
+    /// Create a new worker and pin it if necessary
+    void addWorker();
+
+    /// Pin the given worker according to current placement
+    void pinWorker(int worker_idx);
+
+    /// Main loop of the workers, 'last_generation' is the generation at the
+    /// creation of the worker, the worker runs all the batches started after
+    void workerLoop(int worker_idx, unsigned long last_generation);
+
+    /// Process jobs of the current batch until there is no job left
+    /// worker_idx is -1 for the calling thread
+    void processJobs(int worker_idx);
+
+    /// Run the job and update the batch status
+    void processJob(int job_idx);
+
+    /// Throw a logic_error if the calling thread is running a batch of this
+    /// pool, since 'method' would then wait for the batch to end
+    void checkNotRunning(const std::string & method) const;
+
+    /// Run jobs on temporary threads, used when the pool is busy
+    static void runOnNewThreads(int nb_jobs, const Job & job);
+
+    /// The workers, calling thread is not included
+    std::vector<std::thread> workers;
+
+    /// Cores used for the workers, empty if workers are not pinned
+    std::vector<int> cores;
+
+    /// Ensure that only one batch is processed at a time
+    std::mutex run_mutex;
+    /// Thread holding run_mutex while running a batch, used to detect nested
+    /// calls from the jobs processed by the calling thread
+    std::atomic<std::thread::id> run_owner;
+
+    /// Protect the members describing the current batch
+    std::mutex batch_mutex;
+    /// Used to wake up workers when a batch is available
+    std::condition_variable batch_start;
+    /// Used to notify the caller when workers are done
+    std::condition_variable batch_end;
+
+    /// Incremented each time a new batch is started
+    unsigned long generation;
+    /// Number of workers currently processing jobs
+    int active_workers;
+    /// When true, workers leave their loop
+    bool stop;
+
+    /// Job of the current batch
+    const Job * job;
+    /// Number of jobs in the current batch
+    int nb_jobs;
+    /// When enabled, job 'i' is run by worker 'i'
+    bool static_assignment;
+    /// Index of the next job to run
+    std::atomic<int> next_job;
+    /// Number of jobs which have been processed
+    std::atomic<int> nb_done_jobs;
+    /// First exception thrown by a job of the current batch
+    std::exception_ptr error;
+  };
+
+  /// Describe how the tasks in [0,nb_tasks[ are distributed among threads
+  struct Schedule
+  {
+    enum class Type
+    {
+      /// One block of contiguous tasks per thread, see buildIntervals
+      Static,
+      /// Threads take chunks of 'grain' tasks from a shared counter
+      Dynamic,
+      /// Each thread starts with its static block, processes it by chunks of
+      /// 'grain' tasks and steals half of the remaining tasks of other threads
+      /// once its own block is empty
+      WorkStealing
+    };
+
+    Schedule(Type type = Type::Static, int grain = 1);
+
+    Type type;
+    /// Number of tasks processed at once by a thread (unused for Static)
+    int grain;
+  };
+
+  /// Statistics on the load of each thread during a run
+  struct RunStats
+  {
+    /// Time elapsed between the beginning of the run and its end [s]
+    double wall_time;
+    /// For each thread, time spent processing tasks [s]
+    std::vector<double> busy_times;
+    /// For each thread, number of tasks processed
+    std::vector<int> nb_tasks;
+    /// For each thread, number of calls to the task
+    std::vector<int> nb_chunks;
+    /// For each thread, number of successful steals (WorkStealing only)
+    std::vector<int> nb_steals;
+
+    /// Ratio between the maximal and the average busy time of the threads,
+    /// 1 is a perfect balance
+    double getImbalance() const;
+
+    /// Ratio between the total busy time and wall_time * nb_threads
+    double getEfficiency() const;
+
+    void print(std::ostream & out) const;
+  };
+
+  /// Split the box [0,sizes[0][ x ... x [0,sizes[n-1][ in tiles of size
+  /// 'tile_sizes' (tiles at the upper border might be smaller) and run 't'
+  /// once for each tile, tiles are distributed among threads according to
+  /// 'schedule'. Throw a logic_error if there are more tiles than the
+  /// maximal value of an int
+  static void parallelFor(TileTask t,
+                          const std::vector<int> & sizes,
+                          const std::vector<int> & tile_sizes,
+                          int nb_threads,
+                          const Schedule & schedule = Schedule(Schedule::Type::Dynamic));
+
+  /// Return the size of tiles containing at most 'max_tile_elements' elements
+  /// (at least one). First dimensions are considered as the contiguous ones,
+  /// thus they are filled first
+  static std::vector<int> buildTileSizes(const std::vector<int> & sizes,
+                                         int max_tile_elements);
+
+  /// Allow to interrupt a run before all the tasks are processed, either
+  /// explicitly or once a deadline is reached. It is checked by the workers
+  /// between two chunks and can also be checked by the tasks themselves
+  class CancellationToken
+  {
+  public:
+    /// Token without deadline
+    CancellationToken();
+    /// Token which is automatically cancelled once 'deadline' is reached
+    CancellationToken(const TimeStamp & deadline);
+
+    /// Can be called from any thread
+    void cancel();
+
+    /// Return true if cancel has been called or if the deadline is reached
+    bool isCancelled() const;
+
+    bool hasDeadline() const;
+    const TimeStamp & getDeadline() const;
+
+  private:
+    std::atomic<bool> cancelled;
+    bool has_deadline;
+    TimeStamp deadline;
+  };
+
+  /// Tasks which have been processed during a cancellable run
+  struct Completion
+  {
+    /// Sorted and disjoint intervals of the tasks which have been processed
+    Intervals processed;
+    /// Total number of tasks processed
+    int nb_processed;
+    /// True if all the tasks have been processed
+    bool complete;
+  };
+
+  /// Internal state of a task submitted asynchronously
+  class AsyncNode;
+
+  /// Handle on a task submitted with runAsyncTask, it can be used to wait for
+  /// the task or as a dependency of other asynchronous tasks
+  class AsyncHandle
+  {
+  public:
+    /// Build an invalid handle
+    AsyncHandle();
+
+    /// Return true if the handle refers to a task
+    bool isValid() const;
+
+    /// Return true if the task is finished (successfully or not)
+    bool isReady() const;
+
+    /// Block until the task is finished, rethrow the exception raised by the
+    /// task or by one of its dependencies if any
+    /// Waiting from inside an asynchronous task might lead to deadlocks
+    void wait() const;
+
+    /// Access to the underlying future
+    std::shared_future<void> getFuture() const;
+
+  private:
+    friend class MultiCore;
+
+    AsyncHandle(std::shared_ptr<AsyncNode> node);
+
+    std::shared_ptr<AsyncNode> node;
+  };
 
   static Intervals buildIntervals(int nb_tasks, int nb_threads);
 
@@ -28,6 +356,16 @@ public:
                               int nb_tasks,
                               int nb_threads);
 
+  /// Same as above, but tasks are distributed according to 'schedule'. With
+  /// Dynamic and WorkStealing, 't' is called several times by each thread on
+  /// smaller intervals. If 'stats' is not null, it is filled with the load of
+  /// each thread
+  static void runParallelTask(Task t,
+                              int nb_tasks,
+                              int nb_threads,
+                              const Schedule & schedule,
+                              RunStats * stats = nullptr);
+
   /// Can be used when a function 'f' needs to be run for all values in [0,nb_tasks[
   /// It should be safe to run the function from multiple thread at the same time
   /// Since the task is stochastic, multiple engines have to be provided, the number
@@ -35,6 +373,176 @@ public:
   static void runParallelStochasticTask(StochasticTask st,
                                         int nb_tasks,
                                         std::vector<std::default_random_engine> * engines);
+
+  /// Same as above, but tasks are distributed according to 'schedule'. Engine
+  /// 'i' is only used by thread 'i', whatever the schedule
+  static void runParallelStochasticTask(StochasticTask st,
+                                        int nb_tasks,
+                                        std::vector<std::default_random_engine> * engines,
+                                        const Schedule & schedule,
+                                        RunStats * stats = nullptr);
+
+  /// Run 't' on [0,nb_tasks[ until all tasks are processed or 'token' is
+  /// cancelled. Between chunks, the token is checked by the scheduler, a
+  /// Static schedule can thus only be interrupted by the tasks themselves
+  /// Return the intervals which have been processed
+  static Completion runCancellableTask(CancellableTask t,
+                                       int nb_tasks,
+                                       int nb_threads,
+                                       const CancellationToken & token,
+                                       const Schedule & schedule =
+                                       Schedule(Schedule::Type::Dynamic),
+                                       RunStats * stats = nullptr);
+
+  /// Can be used when a function 'f' needs to be run for all values in [0,nb_tasks[
+  /// It should be safe to run the function from multiple thread at the same time
+  /// Before each call, the engine is seeded with getTaskSeed(seed, task_idx),
+  /// thus results do not depend on the number of threads or on the schedule
+  static void runParallelSeededTask(SeededTask st,
+                                    int nb_tasks,
+                                    int nb_threads,
+                                    unsigned long seed,
+                                    const Schedule & schedule = Schedule(),
+                                    RunStats * stats = nullptr);
+
+  /// Return the 64 bits seed of the random stream associated to 'task_idx',
+  /// computing it is O(1) and streams of different tasks are decorrelated by hashing
+  static uint64_t getTaskSeed(unsigned long seed, int task_idx);
+
+  /// Compute combine(...combine(combine(init, map(0)), map(1))..., map(nb_tasks-1))
+  /// with 'nb_threads' threads. Tasks are split in at most 256 blocks which
+  /// only depend on 'nb_tasks', a partial result is accumulated
+  /// over each block starting from 'init' and partial results are then
+  /// combined in a fixed tree order. Thus the result is reproducible whatever
+  /// the number of threads, even for floating point values.
+  /// - 'init' should be a neutral element for 'combine', T should be copyable
+  /// - 'map' has signature: T(int idx)
+  /// - 'combine' has signature: T(const T & a, const T & b), it should be associative
+  template <typename T, typename Map, typename Combine>
+  static T parallelReduce(const T & init, Map map, Combine combine,
+                          int nb_tasks, int nb_threads)
+  {
+    return reduce<T>(init,
+                     [&map](int idx, int) { return map(idx); },
+                     combine, nb_tasks, nb_threads);
+  }
+
+  /// Stochastic version of parallelReduce, the number of threads is defined
+  /// by the size of the 'engines' vector. The order of the combinations does
+  /// not depend on it, but the values drawn by 'map' do
+  /// - 'map' has signature: T(int idx, std::default_random_engine * engine)
+  template <typename T, typename Map, typename Combine>
+  static T parallelStochasticReduce(const T & init, Map map, Combine combine,
+                                    int nb_tasks,
+                                    std::vector<std::default_random_engine> * engines)
+  {
+    if (engines == nullptr || engines->size() == 0) {
+      throw std::runtime_error("MultiCore::parallelStochasticReduce with no engines");
+    }
+    return reduce<T>(init,
+                     [&map, engines](int idx, int thread_no)
+                     {
+                       return map(idx, &((*engines)[thread_no]));
+                     },
+                     combine, nb_tasks, engines->size());
+  }
+
+  /// Submit the task on [0,nb_tasks[ split among 'nb_threads' intervals and
+  /// return immediately. The task is started once all the 'dependencies' are
+  /// finished, if one of them failed, the task is not run and the exception
+  /// is forwarded to its handle. All asynchronous tasks share the same workers
+  static AsyncHandle runAsyncTask(Task t,
+                                  int nb_tasks,
+                                  int nb_threads,
+                                  const std::vector<AsyncHandle> & dependencies =
+                                  std::vector<AsyncHandle>());
+
+  /// Asynchronous version of runParallelStochasticTask, 'engines' should not
+  /// be used by any other task until the returned handle is ready
+  static AsyncHandle runAsyncStochasticTask(StochasticTask st,
+                                            int nb_tasks,
+                                            std::vector<std::default_random_engine> * engines,
+                                            const std::vector<AsyncHandle> & dependencies =
+                                            std::vector<AsyncHandle>());
+
+private:
+  /// A task which also receives the index of the thread running it
+  typedef std::function<void(int thread_no, int start_idx, int end_idx)> ThreadTask;
+  /// Same as ThreadTask, but returning the index reached, only the tasks in
+  /// [start_idx, returned index[ have been processed
+  typedef std::function<int(int thread_no, int start_idx, int end_idx)> PartialThreadTask;
+
+  /// Create the node associated to the task and submit it once dependencies are ready
+  static AsyncHandle submitAsyncTask(ThreadTask t,
+                                     int nb_tasks,
+                                     int nb_threads,
+                                     const std::vector<AsyncHandle> & dependencies);
+
+  /// Maximal number of partial results of a reduction
+  static const int max_reduce_blocks = 256;
+
+  /// Ensure that two consecutive values are not on the same cache line
+  template <typename T>
+  struct PaddedValue
+  {
+    PaddedValue(const T & value_) : value(value_) {}
+
+    T value;
+    char padding[64];
+  };
+
+  /// 'map' has signature: T(int idx, int thread_no)
+  template <typename T, typename Map, typename Combine>
+  static T reduce(const T & init, Map map, Combine combine,
+                  int nb_tasks, int nb_threads)
+  {
+    if (nb_tasks <= 0) return init;
+    if (nb_threads < 1) {
+      throw std::logic_error("MultiCore::reduce: nb_threads should be strictly positive");
+    }
+    // Blocks do not depend on the number of threads
+    Intervals blocks = buildIntervals(nb_tasks, std::min(nb_tasks, (int)max_reduce_blocks));
+    int nb_partials = blocks.size();
+    std::vector<PaddedValue<T>> partials(nb_partials, PaddedValue<T>(init));
+    runScheduledTask([&map, &combine, &blocks, &partials](int thread_no, int start, int end)
+                     {
+                       for (int block = start; block < end; block++) {
+                         T acc = partials[block].value;
+                         for (int idx = blocks[block].first; idx < blocks[block].second; idx++) {
+                           acc = combine(acc, map(idx, thread_no));
+                         }
+                         partials[block].value = std::move(acc);
+                       }
+                     },
+                     nb_partials, std::min(nb_partials, nb_threads), Schedule(), nullptr);
+    // Pairwise combination: (0,1), (2,3), ... then (0,2), (4,6), ...
+    for (int step = 1; step < nb_partials; step *= 2) {
+      for (int idx = 0; idx + step < nb_partials; idx += 2 * step) {
+        partials[idx].value = combine(partials[idx].value, partials[idx + step].value);
+      }
+    }
+    return partials[0].value;
+  }
+
+  /// Distribute [0,nb_tasks[ among 'nb_threads' according to 'schedule'. The
+  /// threads running the tasks are attached to the Benchmark::WorkerGroup of
+  /// the current zone of the calling thread
+  static void runScheduledTask(ThreadTask t,
+                               int nb_tasks,
+                               int nb_threads,
+                               const Schedule & schedule,
+                               RunStats * stats);
+
+  /// Same as runScheduledTask, but a thread stops taking chunks once 'token'
+  /// is cancelled or once a task stops before the end of its chunk. Intervals
+  /// actually processed are stored in 'processed' if it is not null
+  static void runPartialTask(PartialThreadTask t,
+                             int nb_tasks,
+                             int nb_threads,
+                             const Schedule & schedule,
+                             RunStats * stats,
+                             const CancellationToken * token,
+                             Intervals * processed);
 };
 
 }
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace rosban_utils
+{
+
+/// Access to the performance counters of the calling thread through the
+/// Linux perf_event_open interface. Counters which cannot be opened (not
+/// permitted, not supported by the processor or a virtual machine, not on
+/// Linux) are simply not available and read as 0.
+/// Hardware events are only counted in user-space, so that they remain
+/// available with the default perf_event_paranoid setting. Context switches
+/// can only be counted with the kernel, they are not available otherwise.
+/// When more events are requested than the processor can count, the kernel
+/// multiplexes them: differences of readings are then scaled by the ratio of
+/// the time the group was enabled to the time it was actually counting.
+class PerfCounters
+{
+public:
+  enum Counter
+  {
+    Cycles = 0,
+    Instructions,
+    CacheMisses,
+    BranchMisses,
+    /// Software counter, usually available even if hardware counters are not
+    ContextSwitches,
+    NbCounters
+  };
+
+  typedef std::array<uint64_t, NbCounters> Values;
+
+  /// Values of the counters at a given time
+  struct Reading
+  {
+    Values values;
+    /// Time during which the group was enabled [ns]
+    uint64_t time_enabled;
+    /// Time during which the group was actually counting [ns]
+    uint64_t time_running;
+  };
+
+  /// Open all the available counters for the calling thread, the object
+  /// should then only be read from this thread
+  PerfCounters();
+  ~PerfCounters();
+
+  PerfCounters(const PerfCounters & other) = delete;
+  PerfCounters & operator=(const PerfCounters & other) = delete;
+
+  bool isAvailable(Counter counter) const;
+  /// True if at least one hardware counter could be opened
+  bool hasHardwareCounters() const;
+  /// Bit i is set if counter i is available
+  unsigned int getAvailabilityMask() const;
+
+  /// Read the current value of all the counters with a single system call,
+  /// unavailable counters are set to 0. It does not throw, since it is used
+  /// in destructors: on failure, the reading is set to 0, the error is
+  /// recorded (see hasError) and false is returned
+  bool read(Reading & reading) const noexcept;
+
+  /// True if a read has failed since the construction
+  bool hasError() const;
+
+  /// Compute the values counted between 'start' and 'end', scaled if the
+  /// counters were multiplexed in the meantime. Return true if values were
+  /// scaled, they are then estimations, or if the counters were not running
+  /// at all, they are then 0
+  static bool getDifference(const Reading & start, const Reading & end, Values & difference);
+
+  /// Short name of the counter, e.g. "cycles"
+  static std::string getName(Counter counter);
+
+private:
+  /// File descriptor of the group leader, -1 if no counter is available
+  int leader_fd;
+  /// File descriptors of all the counters, -1 for unavailable counters
+  std::array<int, NbCounters> fds;
+  /// Position of each counter in the values read from the group, -1 if unavailable
+  std::array<int, NbCounters> positions;
+  /// Number of counters in the group
+  int nb_opened;
+  /// Has a read failed
+  mutable bool has_error;
+};
+
+}
@@ -2,6 +2,7 @@
 
 #include <Eigen/Core>
 
+#include <functional>
 #include <vector>
 
 namespace rosban_utils
@@ -16,4 +17,20 @@ Eigen::MatrixXd discretizeSpace(const Eigen::MatrixXd & limits,
 /// Each column is a different sample
 Eigen::MatrixXd discretizeSpace(const Eigen::MatrixXd & limits,
                                 const std::vector<int> & samples_by_dim);
+
+/// Function applied to a point of a grid, 'point' is a view on the column
+/// 'point_idx' of the grid, no copy is performed
+typedef std::function<void(int point_idx,
+                           Eigen::MatrixXd::ConstColXpr point)> GridFunction;
+
+/// Apply 'f' in parallel to all the points of 'grid', a matrix produced by
+/// discretizeSpace(limits, samples_by_dim). Instead of splitting the columns
+/// in contiguous blocks, the grid is split in N-dimensional tiles containing
+/// at most tile_bytes / (grid.rows() * sizeof(double)) points, so that
+/// neighbours along all dimensions are processed by the same thread
+void parallelForGrid(const Eigen::MatrixXd & grid,
+                     const std::vector<int> & samples_by_dim,
+                     GridFunction f,
+                     int nb_threads,
+                     int tile_bytes = 32 * 1024);
 }
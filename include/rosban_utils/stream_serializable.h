@@ -1,5 +1,8 @@
 #pragma once
 
+#include "rosban_utils/compression.h"
+#include "rosban_utils/io_tools.h"
+
 #include <istream>
 #include <ostream>
 
@@ -7,6 +10,12 @@ namespace rosban_utils
 {
 
 /// This class is used to serialize objects into binary streams
+///
+/// Overloads based on BinaryWriter and BinaryReader avoid the cost of a virtual
+/// stream call per value, by default they forward to the std::ostream and
+/// std::istream versions. Classes overriding only some of the overloads of
+/// writeInternal, read or save should add 'using StreamSerializable::read;' (resp.
+/// writeInternal, save) to avoid hiding the others.
 class StreamSerializable
 {
 public:
@@ -24,16 +33,47 @@ public:
   /// return total number of bytes written
   virtual int writeInternal(std::ostream & out) const = 0;
 
+  /// Write the classID and then write internal content to a buffered writer
+  /// return total number of bytes written
+  int write(BinaryWriter & out) const;
+
+  /// Same as writeInternal(std::ostream &) with a buffered writer
+  /// return total number of bytes written
+  virtual int writeInternal(BinaryWriter & out) const;
+
+  /// Number of bytes written by writeInternal. By default, the object is
+  /// written to a stream which only counts bytes, classes able to compute
+  /// their size directly should override it
+  virtual int getSerializedSize() const;
+
+  /// Write the classID and then write internal content directly to memory,
+  /// 'size' should be at least sizeof(int) + getSerializedSize().
+  /// Throw a runtime_error if the buffer is too small
+  /// return total number of bytes written
+  int writeTo(char * buffer, size_t size) const;
+
   /// Read directly data from a binary stream, assuming the true type of the
   /// object has already been established
   /// Return the number of bytes read
   virtual int read(std::istream & in) = 0;
 
+  /// Same as read(std::istream &) with a buffered reader, by default errors
+  /// of the reader are thrown through the stream even if read ignores its state
+  /// Return the number of bytes read
+  virtual int read(BinaryReader & in);
+
   /// Save the object to the given file and return the number of bytes written
   /// - write_class_id is required if loader is not supposed to know the true type of the object
   virtual int save(const std::string & filename, bool write_class_id = true) const;
 
-  /// Load the content of the object from the given path
+  /// Save the object to the given file using the provided compression and
+  /// return the number of bytes written before compression
+  int save(const std::string & filename, Compression compression,
+           bool write_class_id = true) const;
+
+  /// Load the content of the object from the given path, the file is mapped
+  /// in memory and read(BinaryReader &) can access it without copy.
+  /// Compressed files are detected and decompressed on the fly
   void load(const std::string & path);
 };
 
@@ -0,0 +1,227 @@
+#include "rosban_utils/archive.h"
+
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <unistd.h>
+
+namespace rosban_utils
+{
+
+namespace
+{
+
+const char header_magic[4] = {'R', 'B', 'A', 'R'};
+const char record_magic[4] = {'R', 'B', 'R', 'C'};
+const char footer_magic[4] = {'R', 'B', 'A', 'I'};
+const int format_version = 2;
+const size_t header_size = sizeof(header_magic) + sizeof(int);
+/// Magic and length
+const size_t record_header_size = sizeof(record_magic) + sizeof(uint64_t);
+/// Number of records, footer offset and magic
+const size_t footer_tail_size = 2 * sizeof(uint64_t) + sizeof(footer_magic);
+
+}
+
+ArchiveWriter::ArchiveWriter(const std::string & archive_path, bool append)
+  : path(archive_path), base_offset(0), is_closed(false)
+{
+  bool file_exists = std::ifstream(path).good();
+  if (append && file_exists) {
+    {
+      ArchiveReader reader(path);
+      offsets = reader.offsets;
+      base_offset = reader.data_end;
+    }
+    // Removing the footer and incomplete records
+    if (truncate(path.c_str(), base_offset) != 0) {
+      throw std::runtime_error("ArchiveWriter: failed to truncate '" + path + "'");
+    }
+    file.open(path, std::ios::binary | std::ios::app);
+  }
+  else {
+    file.open(path, std::ios::binary | std::ios::trunc);
+  }
+  if (!file) {
+    throw std::runtime_error("ArchiveWriter: failed to open '" + path + "' for binary writing");
+  }
+  writer.reset(new BinaryWriter(file));
+  if (!append || !file_exists) {
+    writer->writeRaw(header_magic, sizeof(header_magic));
+    writer->write<int>(format_version);
+  }
+}
+
+ArchiveWriter::~ArchiveWriter()
+{
+  // Errors can only be handled by calling close explicitly
+  try {
+    close();
+  }
+  catch (const std::runtime_error & exc) {
+  }
+}
+
+size_t ArchiveWriter::write(const StreamSerializable & object)
+{
+  if (is_closed) {
+    throw std::logic_error("ArchiveWriter::write: archive '" + path + "' is closed");
+  }
+  record.clear();
+  object.write(record);
+  uint64_t offset = base_offset + writer->getNbBytesWritten();
+  writer->writeRaw(record_magic, sizeof(record_magic));
+  writer->write<uint64_t>(record.getSize());
+  writer->writeRaw(record.getData(), record.getSize());
+  offsets.push_back(offset);
+  return offsets.size() - 1;
+}
+
+size_t ArchiveWriter::getNbRecords() const
+{
+  return offsets.size();
+}
+
+void ArchiveWriter::close()
+{
+  if (is_closed) return;
+  is_closed = true;
+  uint64_t footer_offset = base_offset + writer->getNbBytesWritten();
+  writer->writeArray<uint64_t>(offsets.data(), offsets.size());
+  writer->write<uint64_t>(offsets.size());
+  writer->write<uint64_t>(footer_offset);
+  writer->writeRaw(footer_magic, sizeof(footer_magic));
+  writer->flush();
+  file.close();
+  if (!file) {
+    throw std::runtime_error("ArchiveWriter::close: failed to write '" + path + "'");
+  }
+}
+
+ArchiveReader::ArchiveReader(const std::string & path)
+  : file(new MappedFile(path, MappedFile::Access::Random)), data_end(header_size)
+{
+  if (file->getSize() < header_size ||
+      std::memcmp(file->getData(), header_magic, sizeof(header_magic)) != 0) {
+    throw std::runtime_error("ArchiveReader: '" + path + "' is not an archive");
+  }
+  int version;
+  std::memcpy(&version, file->getData() + sizeof(header_magic), sizeof(int));
+  if (version != format_version) {
+    std::ostringstream oss;
+    oss << "ArchiveReader: unsupported version " << version << " in '" << path << "'";
+    throw std::runtime_error(oss.str());
+  }
+  if (!readFooter()) {
+    scanRecords();
+  }
+}
+
+size_t ArchiveReader::getNbRecords() const
+{
+  return offsets.size();
+}
+
+int ArchiveReader::getClassID(size_t index) const
+{
+  return getReader(index)->read<int>();
+}
+
+size_t ArchiveReader::getRecordSize(size_t index) const
+{
+  size_t available;
+  getReader(index)->peek(&available);
+  return available - sizeof(int);
+}
+
+std::unique_ptr<BinaryReader> ArchiveReader::getRecordReader(size_t index) const
+{
+  std::unique_ptr<BinaryReader> reader = getReader(index);
+  reader->read<int>();
+  return reader;
+}
+
+void ArchiveReader::read(size_t index, StreamSerializable & object) const
+{
+  std::unique_ptr<BinaryReader> reader = getReader(index);
+  int class_id = reader->read<int>();
+  if (class_id != object.getClassID()) {
+    std::ostringstream oss;
+    oss << "ArchiveReader::read: record " << index << " has class ID " << class_id
+        << " while object has class ID " << object.getClassID();
+    throw std::runtime_error(oss.str());
+  }
+  object.read(*reader);
+}
+
+std::unique_ptr<BinaryReader> ArchiveReader::getReader(size_t index) const
+{
+  if (index >= offsets.size()) {
+    std::ostringstream oss;
+    oss << "ArchiveReader: record " << index << " does not exist, archive has "
+        << offsets.size() << " records";
+    throw std::out_of_range(oss.str());
+  }
+  uint64_t length;
+  std::memcpy(&length, file->getData() + offsets[index] + sizeof(record_magic), sizeof(uint64_t));
+  const char * record_start = file->getData() + offsets[index] + record_header_size;
+  return std::unique_ptr<BinaryReader>(new BinaryReader(record_start, length, file));
+}
+
+bool ArchiveReader::readRecordHeader(uint64_t offset, uint64_t limit, uint64_t & length) const
+{
+  if (offset > limit || limit - offset < record_header_size) return false;
+  const char * data = file->getData() + offset;
+  if (std::memcmp(data, record_magic, sizeof(record_magic)) != 0) return false;
+  std::memcpy(&length, data + sizeof(record_magic), sizeof(uint64_t));
+  return length <= limit - offset - record_header_size;
+}
+
+bool ArchiveReader::readFooter()
+{
+  size_t size = file->getSize();
+  const char * data = file->getData();
+  if (size < header_size + footer_tail_size ||
+      std::memcmp(data + size - sizeof(footer_magic), footer_magic, sizeof(footer_magic)) != 0) {
+    return false;
+  }
+  uint64_t nb_records, footer_offset;
+  const char * tail = data + size - footer_tail_size;
+  std::memcpy(&nb_records, tail, sizeof(uint64_t));
+  std::memcpy(&footer_offset, tail + sizeof(uint64_t), sizeof(uint64_t));
+  // Both values are read from the file, bounded before computing the footer size
+  if (footer_offset < header_size || footer_offset > size - footer_tail_size ||
+      nb_records > (size - footer_tail_size - footer_offset) / sizeof(uint64_t) ||
+      footer_offset + nb_records * sizeof(uint64_t) + footer_tail_size != size) {
+    return false;
+  }
+  offsets.resize(nb_records);
+  std::memcpy(offsets.data(), data + footer_offset, nb_records * sizeof(uint64_t));
+  // Records should follow each other without overlapping, before the footer
+  uint64_t previous_end = header_size;
+  for (uint64_t offset : offsets) {
+    uint64_t length;
+    if (offset < previous_end || !readRecordHeader(offset, footer_offset, length)) {
+      offsets.clear();
+      return false;
+    }
+    previous_end = offset + record_header_size + length;
+  }
+  data_end = footer_offset;
+  return true;
+}
+
+void ArchiveReader::scanRecords()
+{
+  uint64_t offset = header_size;
+  uint64_t length;
+  // Stops at the first incomplete record or at the footer
+  while (readRecordHeader(offset, file->getSize(), length)) {
+    offsets.push_back(offset);
+    offset += record_header_size + length;
+  }
+  data_end = offset;
+}
+
+}
@@ -0,0 +1,261 @@
+#include "rosban_utils/async_logger.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+namespace rosban_utils
+{
+
+AsyncLogger::Config::Config()
+  : buffer_size(1 << 20), nb_buffers(8), policy(OverflowPolicy::Drop), flush_period(1.0)
+{
+}
+
+AsyncLogger::AsyncLogger(const std::string & logger_path, const Config & logger_config)
+  : path(logger_path), config(logger_config), buffers(std::max(config.nb_buffers, 0)),
+    nb_submitted(0), nb_written(0), has_current(false), nb_records(0), nb_bytes_logged(0),
+    nb_bytes_written(0), nb_drops(0), max_enqueue_latency(0),
+    is_background_waiting(false), is_logging_waiting(false),
+    stop_requested(false), has_failed(false), is_closed(false)
+{
+  if (config.nb_buffers < 2 || config.buffer_size == 0 || !(config.flush_period > 0)) {
+    std::ostringstream oss;
+    oss << "AsyncLogger: invalid config, nb_buffers: " << config.nb_buffers
+        << ", buffer_size: " << config.buffer_size << ", flush_period: " << config.flush_period;
+    throw std::logic_error(oss.str());
+  }
+  file.open(path, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    throw std::runtime_error("AsyncLogger: failed to open '" + path + "' for binary writing");
+  }
+  // Memory is touched now to avoid page faults while logging
+  for (Buffer & buffer : buffers) {
+    buffer.data.resize(config.buffer_size);
+    buffer.used = 0;
+  }
+  thread = std::thread(&AsyncLogger::run, this);
+}
+
+AsyncLogger::~AsyncLogger()
+{
+  // Errors can only be handled by calling close explicitly
+  try {
+    close();
+  }
+  catch (const std::runtime_error & exc) {
+  }
+}
+
+bool AsyncLogger::log(const StreamSerializable & object)
+{
+  if (is_closed) {
+    throw std::logic_error("AsyncLogger::log: logger '" + path + "' is closed");
+  }
+  checkError();
+  Clock::time_point start = Clock::now();
+  bool accepted = has_current || acquireBuffer();
+  size_t size = 0;
+  if (accepted) {
+    // The object is serialized directly after the previous ones of the buffer
+    Buffer & buffer = buffers[nb_submitted.load(std::memory_order_relaxed) % buffers.size()];
+    size_t used = buffer.used.load(std::memory_order_relaxed);
+    bool fits = true;
+    try {
+      BinaryWriter slot(buffer.data.data() + used, buffer.data.size() - used);
+      object.write(slot);
+      size = slot.getSize();
+    }
+    catch (const std::runtime_error & exc) {
+      fits = false;
+    }
+    if (fits) {
+      // Published once complete: the background thread might write it
+      // before the buffer is submitted
+      buffer.used.store(used + size, std::memory_order_release);
+    }
+    else {
+      // Bytes written in the slot are simply overwritten later
+      accepted = logRecord(object);
+      size = record.getSize();
+    }
+  }
+  // Only this thread modifies the counters, no read-modify-write is required
+  if (accepted) {
+    nb_records.store(nb_records.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    nb_bytes_logged.store(nb_bytes_logged.load(std::memory_order_relaxed) + size,
+                          std::memory_order_relaxed);
+  }
+  else {
+    nb_drops.store(nb_drops.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+  int64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+  if (latency > max_enqueue_latency.load(std::memory_order_relaxed)) {
+    max_enqueue_latency.store(latency, std::memory_order_relaxed);
+  }
+  return accepted;
+}
+
+bool AsyncLogger::logRecord(const StreamSerializable & object)
+{
+  record.clear();
+  object.write(record);
+  size_t size = record.getSize();
+  if (size > config.buffer_size) {
+    std::ostringstream oss;
+    oss << "AsyncLogger::log: object of " << size << " bytes does not fit in buffers of "
+        << config.buffer_size << " bytes";
+    throw std::runtime_error(oss.str());
+  }
+  Buffer * buffer = &buffers[nb_submitted.load(std::memory_order_relaxed) % buffers.size()];
+  if (buffer->used.load(std::memory_order_relaxed) > 0) {
+    submitBuffer();
+    if (!acquireBuffer()) return false;
+    buffer = &buffers[nb_submitted.load(std::memory_order_relaxed) % buffers.size()];
+  }
+  std::memcpy(buffer->data.data(), record.getData(), size);
+  buffer->used.store(size, std::memory_order_release);
+  return true;
+}
+
+void AsyncLogger::flush()
+{
+  if (has_current &&
+      buffers[nb_submitted.load(std::memory_order_relaxed) % buffers.size()].used.load() > 0) {
+    submitBuffer();
+  }
+}
+
+void AsyncLogger::close()
+{
+  if (is_closed) return;
+  is_closed = true;
+  flush();
+  // Data submitted before the stop request is written before the thread ends
+  stop_requested.store(true);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+  }
+  data_condition.notify_one();
+  thread.join();
+  file.close();
+  if (!file) has_failed.store(true);
+  checkError();
+}
+
+AsyncLogger::Stats AsyncLogger::getStats() const
+{
+  Stats stats;
+  stats.nb_records = nb_records.load(std::memory_order_relaxed);
+  stats.nb_bytes_logged = nb_bytes_logged.load(std::memory_order_relaxed);
+  stats.nb_bytes_written = nb_bytes_written.load(std::memory_order_relaxed);
+  stats.nb_drops = nb_drops.load(std::memory_order_relaxed);
+  stats.max_enqueue_latency = max_enqueue_latency.load(std::memory_order_relaxed) / 1e9;
+  return stats;
+}
+
+bool AsyncLogger::acquireBuffer()
+{
+  uint64_t index = nb_submitted.load(std::memory_order_relaxed);
+  // The buffer is free once the one submitted nb_buffers earlier has been written
+  if (index - nb_written.load(std::memory_order_acquire) >= buffers.size()) {
+    if (config.policy == OverflowPolicy::Drop) return false;
+    std::unique_lock<std::mutex> lock(mutex);
+    // Set before checking the ring, see mutex
+    is_logging_waiting.store(true);
+    space_condition.wait(lock, [this, index]() { return index - nb_written.load() < buffers.size(); });
+    is_logging_waiting.store(false);
+  }
+  has_current = true;
+  return true;
+}
+
+void AsyncLogger::submitBuffer()
+{
+  nb_submitted.store(nb_submitted.load(std::memory_order_relaxed) + 1);
+  has_current = false;
+  if (is_background_waiting.load()) {
+    // Once the mutex is acquired, the background thread is waiting
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+    }
+    data_condition.notify_one();
+  }
+}
+
+void AsyncLogger::run()
+{
+  // Bytes of the buffer nb_written already written while it was being filled
+  size_t nb_flushed_bytes = 0;
+  while (true) {
+    uint64_t index = nb_written.load(std::memory_order_relaxed);
+    Buffer & buffer = buffers[index % buffers.size()];
+    // Stop request is read first: all the buffers submitted before are visible
+    bool stop = stop_requested.load();
+    if (nb_submitted.load() == index) {
+      if (stop) break;
+      size_t used = buffer.used.load(std::memory_order_acquire);
+      if (!waitForData(index) && used > nb_flushed_bytes) {
+        // Objects of the buffer being filled are old enough to be written,
+        // the logging thread only appends bytes after them
+        nb_flushed_bytes = writeData(buffer, nb_flushed_bytes, used);
+        file.flush();
+        if (!file) has_failed.store(true);
+      }
+      continue;
+    }
+    writeData(buffer, nb_flushed_bytes, buffer.used.load(std::memory_order_relaxed));
+    nb_flushed_bytes = 0;
+    buffer.used.store(0, std::memory_order_relaxed);
+    nb_written.store(index + 1);
+    if (is_logging_waiting.load()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+      }
+      space_condition.notify_one();
+    }
+  }
+  file.flush();
+  if (!file) has_failed.store(true);
+}
+
+bool AsyncLogger::waitForData(uint64_t index)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  // Set before checking the ring, see mutex
+  is_background_waiting.store(true);
+  bool has_data = data_condition.wait_for(lock, std::chrono::duration<double>(config.flush_period),
+                                          [this, index]()
+                                          {
+                                            return nb_submitted.load() != index ||
+                                              stop_requested.load();
+                                          });
+  is_background_waiting.store(false);
+  return has_data;
+}
+
+size_t AsyncLogger::writeData(const Buffer & buffer, size_t start, size_t end)
+{
+  // After a failure, buffers are still released to avoid blocking the logging thread
+  if (end > start && !has_failed.load(std::memory_order_relaxed)) {
+    file.write(buffer.data.data() + start, end - start);
+    if (file) {
+      nb_bytes_written.store(nb_bytes_written.load(std::memory_order_relaxed) + end - start,
+                             std::memory_order_relaxed);
+    }
+    else {
+      has_failed.store(true);
+    }
+  }
+  return end;
+}
+
+void AsyncLogger::checkError() const
+{
+  if (has_failed.load()) {
+    throw std::runtime_error("AsyncLogger: failed to write to '" + path + "'");
+  }
+}
+
+}
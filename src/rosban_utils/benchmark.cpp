@@ -1,26 +1,83 @@
 #include "rosban_utils/benchmark.h"
 
 #include <algorithm>
+#include <cmath>
 #include <exception>
 #include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <thread>
 #include <tuple>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
 using namespace std::chrono;
 
 namespace rosban_utils
 {
 
 /* Static variables */
-std::shared_ptr<Benchmark> Benchmark::current;
+thread_local Benchmark * Benchmark::current(nullptr);
+thread_local std::shared_ptr<Benchmark::ThreadState> Benchmark::thread_state;
+std::vector<std::weak_ptr<Benchmark::ThreadState>> Benchmark::thread_states;
+std::recursive_mutex Benchmark::structure_mutex;
+thread_local std::shared_ptr<Benchmark::WorkerGroup> Benchmark::attached_group;
+thread_local Benchmark * Benchmark::attached_tree(nullptr);
+thread_local std::vector<Benchmark::AttachedTree> Benchmark::attached_trees;
+std::atomic<bool> Benchmark::record_timeline(false);
+std::atomic<bool> Benchmark::record_histograms(false);
+std::atomic<bool> Benchmark::record_counters(false);
+thread_local std::unique_ptr<PerfCounters> Benchmark::thread_counters;
+std::atomic<Benchmark::Clock> Benchmark::clock(Benchmark::Clock::Steady);
+std::atomic<double> Benchmark::seconds_per_tick(double(steady_clock::period::num) /
+                                                steady_clock::period::den);
+std::mutex Benchmark::clock_mutex;
+std::atomic<int> Benchmark::nb_open_roots(0);
+
+/// The thread owning a zone never waits for the reporter, which thus accepts
+/// a possibly inconsistent copy of the statistics after this number of attempts
+static const int max_copy_attempts = 100;
 
-Benchmark::Benchmark(std::shared_ptr<Benchmark> f, const std::string & n)
-  : father(f), name(n), elapsed_ticks(0)
+struct Benchmark::WorkerGroup
 {
-  startSession();
+  /// Only locked when a thread is attached to the group for the first time,
+  /// when the trees are absorbed and when they are copied for snapshots
+  std::mutex mutex;
+  /// One tree per thread attached to the group
+  std::vector<std::shared_ptr<Benchmark>> trees;
+};
+
+Benchmark::Attachment::Attachment(const std::shared_ptr<WorkerGroup> & group)
+  : is_active(group && !current), previous_tree(nullptr)
+{
+  if (!is_active) return;
+  previous_group = attached_group;
+  previous_tree = attached_tree;
+  attached_tree = getAttachedTree(group);
+  attached_group = group;
 }
 
-std::shared_ptr<Benchmark> Benchmark::getCurrent()
+Benchmark::Attachment::~Attachment()
+{
+  if (!is_active) return;
+  attached_group = previous_group;
+  attached_tree = previous_tree;
+}
+
+Benchmark::Benchmark(Benchmark * f, const std::string & n)
+  : father(f), name(n), static_name(nullptr), thread_id(std::this_thread::get_id()),
+    sequence(0), opening_ticks(0), closing_ticks(0),
+    elapsed_ticks(0), last_ticks(0), min_ticks(0), max_ticks(0), nb_calls(0),
+    is_counting(false), counters_mask(0), nb_scaled_calls(0)
+{
+  for (std::atomic<uint64_t> & counter : counters) {
+    counter.store(0, std::memory_order_relaxed);
+  }
+}
+
+Benchmark * Benchmark::getCurrent()
 {
   if (!current)
     open("Default");
@@ -33,47 +90,589 @@ Benchmark::~Benchmark()
 
 void Benchmark::startSession()
 {
-  opening_time = steady_clock::now();
+  // Counters are read before the clock to exclude the system call from the time
+  // Calls for which counters could not be read are only timed
+  is_counting = record_counters.load(std::memory_order_relaxed) &&
+    getThreadCounters().read(opening_counters);
+  opening_ticks.store(getTicks(), std::memory_order_relaxed);
 }
 
 void Benchmark::endSession()
 {
-  closing_time = steady_clock::now();
-  elapsed_ticks += double((closing_time - opening_time).count());
+  closing_ticks = getTicks();
+  uint64_t opening = opening_ticks.load(std::memory_order_relaxed);
+  // System calls are done before the update to keep it short
+  bool has_counters = false;
+  bool is_scaled = false;
+  PerfCounters::Values difference;
+  unsigned int mask = 0;
+  if (is_counting) {
+    PerfCounters & perf_counters = getThreadCounters();
+    PerfCounters::Reading closing_counters;
+    has_counters = perf_counters.read(closing_counters);
+    if (has_counters) {
+      is_scaled = PerfCounters::getDifference(opening_counters, closing_counters, difference);
+      mask = perf_counters.getAvailabilityMask();
+    }
+    is_counting = false;
+  }
+  last_ticks = double(closing_ticks - opening);
+  // Only this thread modifies the statistics, no read-modify-write is required
+  beginUpdate();
+  if (has_counters) {
+    for (int counter = 0; counter < PerfCounters::NbCounters; counter++) {
+      counters[counter].store(counters[counter].load(std::memory_order_relaxed) + difference[counter],
+                              std::memory_order_relaxed);
+    }
+    counters_mask.store(counters_mask.load(std::memory_order_relaxed) | mask,
+                        std::memory_order_relaxed);
+    if (is_scaled) {
+      nb_scaled_calls.store(nb_scaled_calls.load(std::memory_order_relaxed) + 1,
+                            std::memory_order_relaxed);
+    }
+  }
+  int calls = nb_calls.load(std::memory_order_relaxed);
+  elapsed_ticks.store(elapsed_ticks.load(std::memory_order_relaxed) + last_ticks,
+                      std::memory_order_relaxed);
+  if (calls == 0 || last_ticks < min_ticks.load(std::memory_order_relaxed)) {
+    min_ticks.store(last_ticks, std::memory_order_relaxed);
+  }
+  if (calls == 0 || last_ticks > max_ticks.load(std::memory_order_relaxed)) {
+    max_ticks.store(last_ticks, std::memory_order_relaxed);
+  }
+  nb_calls.store(calls + 1, std::memory_order_relaxed);
+  endUpdate();
+  if (record_timeline.load(std::memory_order_relaxed)) {
+    Session session;
+    session.start = opening;
+    session.end = closing_ticks;
+    session.thread_id = thread_id;
+    sessions.push_back(session);
+  }
+  if (record_histograms.load(std::memory_order_relaxed)) {
+    if (!histogram) {
+      std::lock_guard<std::recursive_mutex> lock(structure_mutex);
+      histogram.reset(new LatencyHistogram());
+    }
+    // The histogram is copied without checking the sequence: a snapshot
+    // only approximates it
+    histogram->record(closing_ticks - opening);
+  }
 }
 
 
 void Benchmark::open(const std::string &benchmark_name)
 {
+  openZone(benchmark_name.c_str(), false);
+}
+
+void Benchmark::openStatic(const char * benchmark_name)
+{
+  openZone(benchmark_name, true);
+}
+
+void Benchmark::openZone(const char * benchmark_name, bool is_static)
+{
+  // Root zones of attached threads are children of their tree in the group
+  Benchmark * parent = current;
+  if (!current)
+  {
+    if (!thread_state) registerThread();
+    nb_open_roots++;
+    if (!attached_tree) {
+      std::shared_ptr<Benchmark> & root = thread_state->root;
+      // The tree of the previous root is reused if the name matches, it is
+      // only emptied, thus reopening a root does not require any allocation
+      std::shared_ptr<Benchmark> previous_root;
+      if (root && (root->static_name == benchmark_name || root->name == benchmark_name)) {
+        root->reset();
+      }
+      else {
+        std::shared_ptr<Benchmark> new_root(new Benchmark(nullptr, benchmark_name));
+        if (is_static) new_root->static_name = benchmark_name;
+        // The reporter might be copying the previous root, which is only
+        // destroyed once the mutex has been released
+        std::lock_guard<std::recursive_mutex> lock(structure_mutex);
+        previous_root = root;
+        root = new_root;
+      }
+      root->startSession();
+      setCurrent(root.get());
+      return;
+    }
+    parent = attached_tree;
+  }
+  // Reuse existing child if possible, no allocation is required in this case
+  Benchmark * child_benchmark = parent->getChild(benchmark_name);
+  if (child_benchmark)
+  {
+    child_benchmark->startSession();
+    setCurrent(child_benchmark);
+    return;
+  }
   // If child is not existing yet:
-  std::shared_ptr<Benchmark> child_benchmark(new Benchmark(current, benchmark_name));
-  if (current)
+  std::shared_ptr<Benchmark> new_child(new Benchmark(current, benchmark_name));
+  if (is_static)
   {
-    current->children.push_back(child_benchmark);
+    new_child->static_name = benchmark_name;
   }
-  current = child_benchmark;
+  {
+    std::lock_guard<std::recursive_mutex> lock(structure_mutex);
+    parent->children.push_back(new_child);
+  }
+  new_child->startSession();
+  setCurrent(new_child.get());
 }
 
 double Benchmark::close(bool print, int detailLevel, std::ostream &out)
+{
+  return close(print ? Format::Text : Format::None, out, detailLevel);
+}
+
+double Benchmark::close(Format format, std::ostream &out, int detailLevel)
 {
   if (!current)
     throw std::runtime_error("No active benchmark to close");
-  std::shared_ptr<Benchmark> to_close = current;
+  Benchmark * to_close = current;
   to_close->endSession();
 
-  current = to_close->father;
-  if (print) {
-    to_close->print(out, detailLevel);
+  setCurrent(to_close->father);
+  if (current) {
+    if (format != Format::None) absorbThreadTrees(to_close);
+  }
+  else {
+    nb_open_roots--;
+    // Trees of attached threads are absorbed by the owner of their group
+    if (!attached_tree) absorbThreadTrees(to_close);
+  }
+  switch (format) {
+    case Format::None:
+      break;
+    case Format::Text:
+      to_close->print(out, detailLevel);
+      break;
+    case Format::ChromeTrace:
+      to_close->exportChromeTrace(out);
+      break;
+    case Format::FoldedStacks:
+      to_close->exportFoldedStacks(out);
+      break;
+  }
+
+  return ticksToSec(to_close->last_ticks);
+}
+
+std::shared_ptr<Benchmark> Benchmark::takeSnapshot()
+{
+  std::shared_ptr<Benchmark> snapshot(new Benchmark(nullptr, "Snapshot"));
+  std::lock_guard<std::recursive_mutex> lock(structure_mutex);
+  // States are kept alive during the copy, even if their thread exits
+  std::vector<std::shared_ptr<ThreadState>> states;
+  std::vector<const Benchmark *> open_zones;
+  std::vector<const Benchmark *> roots;
+  for (const auto & weak_state : thread_states) {
+    std::shared_ptr<ThreadState> state = weak_state.lock();
+    if (!state) continue;
+    states.push_back(state);
+    const Benchmark * top = state->current.load(std::memory_order_acquire);
+    if (!top) continue;
+    open_zones.push_back(top);
+    while (top->father) {
+      top = top->father;
+      open_zones.push_back(top);
+    }
+    // Zones of attached threads are copied with the zone owning their group
+    if (top == state->root.get()) roots.push_back(top);
+  }
+  // Read after the open zones, thus after their opening
+  uint64_t now = getTicks();
+  for (const Benchmark * root : roots) {
+    snapshot->mergeChild(*root->copyLive(open_zones, now));
+  }
+  return snapshot;
+}
+
+std::shared_ptr<Benchmark> Benchmark::copyLive(const std::vector<const Benchmark *> & open_zones,
+                                               uint64_t now) const
+{
+  std::shared_ptr<Benchmark> copy(new Benchmark(nullptr, name));
+  copy->thread_id = thread_id;
+  copyLiveStats(*copy);
+  if (std::find(open_zones.begin(), open_zones.end(), this) != open_zones.end()) {
+    uint64_t opening = opening_ticks.load(std::memory_order_relaxed);
+    if (now > opening) copy->elapsed_ticks = copy->elapsed_ticks + double(now - opening);
+  }
+  copy->thread_ids = thread_ids;
+  for (const auto & child : children) {
+    std::shared_ptr<Benchmark> child_copy = child->copyLive(open_zones, now);
+    child_copy->father = copy.get();
+    copy->children.push_back(child_copy);
+  }
+  if (worker_group) {
+    std::lock_guard<std::mutex> group_lock(worker_group->mutex);
+    for (const auto & tree : worker_group->trees) {
+      for (const auto & root : tree->children) {
+        copy->mergeChild(*root->copyLive(open_zones, now));
+      }
+    }
+  }
+  return copy;
+}
+
+void Benchmark::copyLiveStats(Benchmark & copy) const
+{
+  for (int attempt = 0; attempt < max_copy_attempts; attempt++) {
+    uint32_t start_sequence = sequence.load(std::memory_order_acquire);
+    copy.elapsed_ticks.store(elapsed_ticks.load(std::memory_order_relaxed));
+    copy.min_ticks.store(min_ticks.load(std::memory_order_relaxed));
+    copy.max_ticks.store(max_ticks.load(std::memory_order_relaxed));
+    copy.nb_calls.store(nb_calls.load(std::memory_order_relaxed));
+    for (int counter = 0; counter < PerfCounters::NbCounters; counter++) {
+      copy.counters[counter].store(counters[counter].load(std::memory_order_relaxed));
+    }
+    copy.counters_mask.store(counters_mask.load(std::memory_order_relaxed));
+    copy.nb_scaled_calls.store(nb_scaled_calls.load(std::memory_order_relaxed));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    bool is_consistent = (start_sequence & 1) == 0 &&
+      sequence.load(std::memory_order_relaxed) == start_sequence;
+    if (is_consistent) break;
+  }
+  if (histogram) {
+    copy.histogram.reset(new LatencyHistogram());
+    copy.histogram->merge(*histogram);
+  }
+}
+
+std::shared_ptr<Benchmark> Benchmark::clone() const
+{
+  std::shared_ptr<Benchmark> copy(new Benchmark(nullptr, name));
+  copy->opening_ticks = opening_ticks.load();
+  copy->closing_ticks = closing_ticks;
+  copy->thread_id = thread_id;
+  copy->merge(*this);
+  return copy;
+}
+
+void Benchmark::subtract(const Benchmark & previous)
+{
+  // The zone has been replaced since previous copy, nothing to subtract
+  if (previous.nb_calls > nb_calls || previous.elapsed_ticks > elapsed_ticks) return;
+  elapsed_ticks = elapsed_ticks - previous.elapsed_ticks;
+  nb_calls -= previous.nb_calls;
+  for (int counter = 0; counter < PerfCounters::NbCounters; counter++) {
+    counters[counter] -= std::min(counters[counter].load(), previous.counters[counter].load());
+  }
+  nb_scaled_calls -= std::min(nb_scaled_calls.load(), previous.nb_scaled_calls.load());
+  min_ticks = std::nan("");
+  max_ticks = std::nan("");
+  if (histogram && previous.histogram) {
+    try {
+      histogram->subtract(*previous.histogram);
+    }
+    catch (const std::logic_error & exc) {
+      histogram.reset();
+    }
+  }
+  if (histogram && histogram->getNbValues() > 0) {
+    min_ticks = histogram->getMin();
+    max_ticks = histogram->getMax();
+  }
+  for (const auto & previous_child : previous.children) {
+    Benchmark * child = getChild(previous_child->name.c_str());
+    if (child) child->subtract(*previous_child);
+  }
+}
+
+bool Benchmark::hasExtrema() const
+{
+  return !std::isnan(min_ticks.load()) && !std::isnan(max_ticks.load());
+}
+
+Benchmark::Reporter::Reporter(std::ostream & output, double report_interval,
+                              int report_detail_level)
+  : out(&output), interval(report_interval), detail_level(report_detail_level)
+{
+  start();
+}
+
+Benchmark::Reporter::Reporter(const std::string & path, double report_interval,
+                              int report_detail_level)
+  : file(new std::ofstream(path, std::ios::app)), out(file.get()),
+    interval(report_interval), detail_level(report_detail_level)
+{
+  if (!*file) {
+    throw std::runtime_error("Benchmark::Reporter: failed to open file '" + path + "'");
+  }
+  start();
+}
+
+Benchmark::Reporter::~Reporter()
+{
+  stop();
+}
+
+void Benchmark::Reporter::start()
+{
+  if (interval <= 0) {
+    throw std::logic_error("Benchmark::Reporter: interval should be strictly positive");
+  }
+  nb_snapshots = 0;
+  stopping = false;
+  previous_time = TimeStamp::now();
+  thread = std::thread(&Reporter::run, this);
+}
+
+void Benchmark::Reporter::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  stop_condition.notify_all();
+  if (thread.joinable()) thread.join();
+}
+
+void Benchmark::Reporter::run()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while (!stop_condition.wait_for(lock, duration<double>(interval),
+                                  [this]() { return stopping; })) {
+    lock.unlock();
+    report();
+    lock.lock();
+  }
+}
+
+void Benchmark::Reporter::report()
+{
+  std::shared_ptr<Benchmark> snapshot = takeSnapshot();
+  TimeStamp now = TimeStamp::now();
+  nb_snapshots++;
+  *out << "=== Benchmark snapshot " << nb_snapshots << " ===" << std::endl;
+  *out << "--- Cumulative ---" << std::endl;
+  for (const auto & root : snapshot->children) {
+    root->print(*out, detail_level);
+  }
+  if (previous) {
+    std::shared_ptr<Benchmark> delta = snapshot->clone();
+    delta->subtract(*previous);
+    *out << "--- Last " << diffSec(previous_time, now) << " s ---" << std::endl;
+    for (const auto & root : delta->children) {
+      root->print(*out, detail_level);
+    }
+  }
+  out->flush();
+  previous = snapshot;
+  previous_time = now;
+}
+
+void Benchmark::setTimelineRecording(bool enabled)
+{
+  record_timeline = enabled;
+}
+
+void Benchmark::setHistogramRecording(bool enabled)
+{
+  record_histograms = enabled;
+}
+
+Benchmark::Latencies Benchmark::getLatencies(const std::string & path)
+{
+  Benchmark * zone = current;
+  if (!zone) {
+    throw std::runtime_error("Benchmark::getLatencies: no active benchmark");
+  }
+  size_t start = 0;
+  while (start < path.size()) {
+    size_t end = path.find('/', start);
+    if (end == std::string::npos) end = path.size();
+    std::string child_name = path.substr(start, end - start);
+    if (child_name.size() > 0) {
+      zone = zone->getChild(child_name.c_str());
+      if (!zone) {
+        std::ostringstream oss;
+        oss << "Benchmark::getLatencies: unknown zone '" << path << "'";
+        throw std::runtime_error(oss.str());
+      }
+    }
+    start = end + 1;
+  }
+  absorbThreadTrees(zone);
+  return zone->computeLatencies();
+}
+
+bool Benchmark::setCounterRecording(bool enabled)
+{
+  record_counters = enabled;
+  return getThreadCounters().hasHardwareCounters();
+}
+
+PerfCounters & Benchmark::getThreadCounters()
+{
+  if (!thread_counters) {
+    thread_counters.reset(new PerfCounters());
+  }
+  return *thread_counters;
+}
+
+bool Benchmark::setClock(Clock new_clock)
+{
+  std::lock_guard<std::mutex> lock(clock_mutex);
+  if (nb_open_roots > 0) {
+    throw std::logic_error("Benchmark::setClock: cannot change clock while zones are open");
+  }
+  bool available = true;
+  if (new_clock == Clock::TSC && !hasInvariantTSC()) {
+    new_clock = Clock::Steady;
+    available = false;
+  }
+  if (new_clock == Clock::TSC) {
+    seconds_per_tick.store(calibrateTSC());
+  }
+  else {
+    seconds_per_tick.store(double(steady_clock::period::num) / steady_clock::period::den);
+  }
+  clock.store(new_clock);
+  return available;
+}
+
+Benchmark::Clock Benchmark::getClock()
+{
+  return clock.load();
+}
+
+bool Benchmark::hasInvariantTSC()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax, ebx, ecx, edx;
+  // Leaf 0x80000007, bit 8 of edx: invariant TSC
+  if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007) {
+    return false;
+  }
+  __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+  return (edx & (1u << 8)) != 0;
+#else
+  return false;
+#endif
+}
+
+double Benchmark::calibrateTSC()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  // Measuring both clocks over a short period
+  steady_clock::time_point steady_start = steady_clock::now();
+  uint64_t tsc_start = __rdtsc();
+  steady_clock::time_point steady_end;
+  do {
+    steady_end = steady_clock::now();
+  } while (steady_end - steady_start < milliseconds(20));
+  uint64_t tsc_end = __rdtsc();
+  double elapsed = duration_cast<duration<double>>(steady_end - steady_start).count();
+  return elapsed / double(tsc_end - tsc_start);
+#else
+  throw std::logic_error("Benchmark::calibrateTSC: TSC is not available on this architecture");
+#endif
+}
+
+double Benchmark::measureClockOverhead(Clock measured_clock, int nb_samples)
+{
+  if (nb_samples <= 0) {
+    throw std::logic_error("Benchmark::measureClockOverhead: nb_samples should be strictly positive");
+  }
+  if (measured_clock == Clock::TSC && !hasInvariantTSC()) {
+    throw std::runtime_error("Benchmark::measureClockOverhead: TSC is not reliable");
+  }
+  // Results are accumulated to ensure reads are not optimized out
+  volatile uint64_t sink = 0;
+  steady_clock::time_point start = steady_clock::now();
+  for (int i = 0; i < nb_samples; i++) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (measured_clock == Clock::TSC) {
+      sink = sink + __rdtsc();
+      continue;
+    }
+#endif
+    sink = sink + steady_clock::now().time_since_epoch().count();
+  }
+  steady_clock::time_point end = steady_clock::now();
+  return duration_cast<duration<double>>(end - start).count() / nb_samples;
+}
+
+void Benchmark::printClockOverheads(std::ostream & out)
+{
+  std::vector<std::pair<std::string, Clock>> clocks;
+  clocks.push_back(std::pair<std::string, Clock>("steady", Clock::Steady));
+  if (hasInvariantTSC()) {
+    clocks.push_back(std::pair<std::string, Clock>("tsc", Clock::TSC));
+  }
+  else {
+    out << "tsc: not available (no invariant TSC)" << std::endl;
+  }
+  for (const auto & entry : clocks) {
+    double overhead = measureClockOverhead(entry.second);
+    // Each zone requires two reads of the clock
+    out << entry.first << ": " << (overhead * 1e9) << " ns per read, "
+        << (2 * overhead * 1e9) << " ns per zone" << std::endl;
   }
-      
-  return to_close->getTime();
 }
 
 double Benchmark::getTime() const
 {
-  double time = elapsed_ticks * steady_clock::period::num / steady_clock::period::den;
-  return time;
-      
+  return ticksToSec(elapsed_ticks);
+}
+
+int Benchmark::getNbCalls() const
+{
+  return nb_calls;
+}
+
+Benchmark::Latencies Benchmark::computeLatencies() const
+{
+  if (!histogram) {
+    std::ostringstream oss;
+    oss << "Benchmark::computeLatencies: no histogram recorded for zone '" << name << "'";
+    throw std::runtime_error(oss.str());
+  }
+  Latencies latencies;
+  latencies.nb_calls = histogram->getNbValues();
+  latencies.p50 = ticksToSec(histogram->getPercentile(50));
+  latencies.p90 = ticksToSec(histogram->getPercentile(90));
+  latencies.p99 = ticksToSec(histogram->getPercentile(99));
+  latencies.p999 = ticksToSec(histogram->getPercentile(99.9));
+  latencies.max = ticksToSec(histogram->getMax());
+  return latencies;
+}
+
+double Benchmark::getMinTime() const
+{
+  return ticksToSec(min_ticks);
+}
+
+double Benchmark::getMaxTime() const
+{
+  return ticksToSec(max_ticks);
+}
+
+double Benchmark::getMeanTime() const
+{
+  if (nb_calls == 0) return 0;
+  return getTime() / nb_calls;
+}
+
+double Benchmark::ticksToSec(double ticks)
+{
+  return ticks * seconds_per_tick.load(std::memory_order_relaxed);
+}
+
+Benchmark * Benchmark::getChild(const char * child_name) const
+{
+  for (const auto & child : children) {
+    // Comparing addresses first avoids comparing strings for static names
+    if (child->static_name == child_name || child->name == child_name) {
+      return child.get();
+    }
+  }
+  return nullptr;
 }
 
 double Benchmark::getSubTime() const
@@ -85,6 +684,267 @@ double Benchmark::getSubTime() const
   return t;
 }
 
+void Benchmark::merge(const Benchmark & other)
+{
+  elapsed_ticks = elapsed_ticks + other.elapsed_ticks;
+  if (other.nb_calls > 0) {
+    if (nb_calls == 0 || other.min_ticks < min_ticks) min_ticks = other.min_ticks.load();
+    if (nb_calls == 0 || other.max_ticks > max_ticks) max_ticks = other.max_ticks.load();
+    last_ticks = other.last_ticks;
+  }
+  sessions.insert(sessions.end(), other.sessions.begin(), other.sessions.end());
+  for (int counter = 0; counter < PerfCounters::NbCounters; counter++) {
+    counters[counter] += other.counters[counter];
+  }
+  counters_mask |= other.counters_mask;
+  nb_scaled_calls += other.nb_scaled_calls;
+  if (other.histogram) {
+    if (!histogram) histogram.reset(new LatencyHistogram());
+    histogram->merge(*other.histogram);
+  }
+  nb_calls += other.nb_calls;
+  if (thread_ids.size() == 0) {
+    thread_ids.push_back(thread_id);
+  }
+  addThreadId(other.thread_id);
+  for (const std::thread::id & id : other.thread_ids) {
+    addThreadId(id);
+  }
+  for (const auto & other_child : other.children) {
+    mergeChild(*other_child);
+  }
+}
+
+void Benchmark::addThreadId(const std::thread::id & id)
+{
+  if (std::find(thread_ids.begin(), thread_ids.end(), id) == thread_ids.end()) {
+    thread_ids.push_back(id);
+  }
+}
+
+void Benchmark::mergeChild(const Benchmark & other)
+{
+  Benchmark * child = getChild(other.name.c_str());
+  if (child) {
+    child->merge(other);
+    return;
+  }
+  std::shared_ptr<Benchmark> new_child(new Benchmark(this, other.name));
+  new_child->opening_ticks = other.opening_ticks.load();
+  new_child->closing_ticks = other.closing_ticks;
+  new_child->thread_id = other.thread_id;
+  new_child->merge(other);
+  children.push_back(new_child);
+}
+
+std::shared_ptr<Benchmark::WorkerGroup> Benchmark::getWorkerGroup()
+{
+  if (!current) return attached_group;
+  if (!current->worker_group) {
+    std::lock_guard<std::recursive_mutex> lock(structure_mutex);
+    current->worker_group.reset(new WorkerGroup());
+  }
+  return current->worker_group;
+}
+
+void Benchmark::absorbThreadTrees()
+{
+  if (!current) {
+    throw std::runtime_error("Benchmark::absorbThreadTrees: no active benchmark");
+  }
+  absorbThreadTrees(current);
+}
+
+void Benchmark::absorbThreadTrees(Benchmark * zone)
+{
+  if (zone->worker_group) {
+    std::lock_guard<std::recursive_mutex> lock(structure_mutex);
+    std::lock_guard<std::mutex> group_lock(zone->worker_group->mutex);
+    for (const auto & tree : zone->worker_group->trees) {
+      // Groups of zones opened inside the tasks
+      absorbThreadTrees(tree.get());
+      for (const auto & root : tree->children) {
+        zone->mergeChild(*root);
+      }
+      tree->reset();
+    }
+  }
+  for (const auto & child : zone->children) {
+    absorbThreadTrees(child.get());
+  }
+}
+
+void Benchmark::reset()
+{
+  beginUpdate();
+  elapsed_ticks.store(0, std::memory_order_relaxed);
+  min_ticks.store(0, std::memory_order_relaxed);
+  max_ticks.store(0, std::memory_order_relaxed);
+  nb_calls.store(0, std::memory_order_relaxed);
+  for (std::atomic<uint64_t> & counter : counters) {
+    counter.store(0, std::memory_order_relaxed);
+  }
+  counters_mask.store(0, std::memory_order_relaxed);
+  nb_scaled_calls.store(0, std::memory_order_relaxed);
+  endUpdate();
+  last_ticks = 0;
+  sessions.clear();
+  if (histogram) histogram->reset();
+  if (!thread_ids.empty()) {
+    std::lock_guard<std::recursive_mutex> lock(structure_mutex);
+    thread_ids.clear();
+  }
+  for (const auto & child : children) {
+    child->reset();
+  }
+}
+
+void Benchmark::registerThread()
+{
+  thread_state.reset(new ThreadState());
+  std::lock_guard<std::recursive_mutex> lock(structure_mutex);
+  // Forgetting the threads which have exited
+  thread_states.erase(std::remove_if(thread_states.begin(), thread_states.end(),
+                                     [](const std::weak_ptr<ThreadState> & state)
+                                     { return state.expired(); }),
+                      thread_states.end());
+  thread_states.push_back(thread_state);
+}
+
+Benchmark * Benchmark::getAttachedTree(const std::shared_ptr<WorkerGroup> & group)
+{
+  for (const AttachedTree & attached : attached_trees) {
+    if (attached.group_address == group.get() && !attached.group.expired()) {
+      return attached.tree;
+    }
+  }
+  // Forgetting the groups which do not exist anymore
+  attached_trees.erase(std::remove_if(attached_trees.begin(), attached_trees.end(),
+                                      [](const AttachedTree & attached)
+                                      { return attached.group.expired(); }),
+                       attached_trees.end());
+  std::shared_ptr<Benchmark> tree(new Benchmark(nullptr, ""));
+  {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    group->trees.push_back(tree);
+  }
+  AttachedTree attached;
+  attached.group = group;
+  attached.group_address = group.get();
+  attached.tree = tree.get();
+  attached_trees.push_back(attached);
+  return tree.get();
+}
+
+namespace
+{
+
+/// Write 'str' as a JSON string
+void writeJSONString(std::ostream & out, const std::string & str)
+{
+  out << '"';
+  for (char c : str) {
+    switch (c) {
+      case '"': out << "\\\""; break;
+      case '\\': out << "\\\\"; break;
+      case '\n': out << "\\n"; break;
+      case '\t': out << "\\t"; break;
+      default:
+        if ((unsigned char)c < 0x20) {
+          out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c
+              << std::dec << std::setfill(' ');
+        }
+        else {
+          out << c;
+        }
+    }
+  }
+  out << '"';
+}
+
+/// Return the track associated to the thread, creating it if necessary
+int getTrack(std::vector<std::thread::id> & threads, const std::thread::id & id)
+{
+  for (size_t track = 0; track < threads.size(); track++) {
+    if (threads[track] == id) return track;
+  }
+  threads.push_back(id);
+  return threads.size() - 1;
+}
+
+}
+
+void Benchmark::exportChromeTrace(std::ostream & out) const
+{
+  std::vector<std::thread::id> threads;
+  bool first_event = true;
+  std::ios::fmtflags old_flags = out.flags();
+  int old_precision = out.precision();
+  out.precision(3);
+  out.setf(std::ios::fixed, std::ios::floatfield);
+  out << "{\"traceEvents\":[" << std::endl;
+  exportChromeEvents(out, threads, first_event, ticksToSec(opening_ticks) * 1000 * 1000);
+  // Naming tracks
+  for (size_t track = 0; track < threads.size(); track++) {
+    if (!first_event) out << "," << std::endl;
+    first_event = false;
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << track
+        << ",\"args\":{\"name\":\"thread " << track << "\"}}";
+  }
+  out << std::endl << "],\"displayTimeUnit\":\"ms\"}" << std::endl;
+  out.flags(old_flags);
+  out.precision(old_precision);
+}
+
+void Benchmark::exportChromeEvents(std::ostream & out,
+                                   std::vector<std::thread::id> & threads,
+                                   bool & first_event,
+                                   double start) const
+{
+  // Content: <start [us], duration [us], thread>
+  typedef std::tuple<double, double, std::thread::id> ChromeEvent;
+  std::vector<ChromeEvent> events;
+  for (const Session & session : sessions) {
+    events.push_back(ChromeEvent(ticksToSec(session.start) * 1000 * 1000,
+                                 ticksToSec(session.end - session.start) * 1000 * 1000,
+                                 session.thread_id));
+  }
+  // Calls were not recorded: a single event starting at 'start'
+  if (events.size() == 0) {
+    events.push_back(ChromeEvent(start, getTime() * 1000 * 1000, thread_id));
+  }
+  for (const ChromeEvent & event : events) {
+    if (!first_event) out << "," << std::endl;
+    first_event = false;
+    out << "{\"name\":";
+    writeJSONString(out, name);
+    out << ",\"ph\":\"X\",\"pid\":0,\"tid\":" << getTrack(threads, std::get<2>(event))
+        << ",\"ts\":" << std::get<0>(event) << ",\"dur\":" << std::get<1>(event)
+        << ",\"args\":{\"calls\":" << nb_calls << "}}";
+  }
+  // Children without recorded calls are placed one after the other
+  double child_start = start;
+  for (const auto & child : children) {
+    child->exportChromeEvents(out, threads, first_event, child_start);
+    child_start += child->getTime() * 1000 * 1000;
+  }
+}
+
+void Benchmark::exportFoldedStacks(std::ostream & out, const std::string & prefix) const
+{
+  // ';' is the separator of the format
+  std::string stack_name = name;
+  std::replace(stack_name.begin(), stack_name.end(), ';', ':');
+  std::string stack = prefix.empty() ? stack_name : prefix + ";" + stack_name;
+  long self_time = std::lround((getTime() - getSubTime()) * 1000 * 1000);
+  if (self_time > 0) {
+    out << stack << " " << self_time << std::endl;
+  }
+  for (const auto & child : children) {
+    child->exportFoldedStacks(out, stack);
+  }
+}
+
 void Benchmark::print(std::ostream &out, int max_depth)
 {
   // Formatting specifically
@@ -144,7 +1004,44 @@ void Benchmark::print(std::ostream & out, int depth, int width,
   }
   for (int i = 0; i < depth; i++) out << '\t';
   out << std::setw(width) << getTime() * 1000 << " ms : "
-      << name << std::endl;
+      << name;
+  if (nb_calls > 1 && hasExtrema()) {
+    out << " (" << nb_calls << " calls, min/mean/max: "
+        << getMinTime() * 1000 << "/" << getMeanTime() * 1000 << "/"
+        << getMaxTime() * 1000 << " ms)";
+  }
+  else if (nb_calls > 1) {
+    out << " (" << nb_calls << " calls, mean: " << getMeanTime() * 1000 << " ms)";
+  }
+  if (histogram && histogram->getNbValues() > 1) {
+    Latencies latencies = computeLatencies();
+    out << " (p50/p90/p99/p99.9/max: "
+        << latencies.p50 * 1000 << "/" << latencies.p90 * 1000 << "/"
+        << latencies.p99 * 1000 << "/" << latencies.p999 * 1000 << "/"
+        << latencies.max * 1000 << " ms)";
+  }
+  if (thread_ids.size() > 1) {
+    out << " (" << thread_ids.size() << " threads)";
+  }
+  if (counters_mask != 0) {
+    std::string separator = " [";
+    for (int counter = 0; counter < PerfCounters::NbCounters; counter++) {
+      if (!(counters_mask & (1u << counter))) continue;
+      out << separator << PerfCounters::getName((PerfCounters::Counter)counter)
+          << ": " << counters[counter];
+      separator = ", ";
+    }
+    unsigned int ipc_mask = (1u << PerfCounters::Cycles) | (1u << PerfCounters::Instructions);
+    if ((counters_mask & ipc_mask) == ipc_mask && counters[PerfCounters::Cycles] > 0) {
+      out << ", IPC: "
+          << double(counters[PerfCounters::Instructions]) / counters[PerfCounters::Cycles];
+    }
+    if (nb_scaled_calls > 0) {
+      out << ", scaled in " << nb_scaled_calls << " calls";
+    }
+    out << "]";
+  }
+  out << std::endl;
 }
 
 }
@@ -0,0 +1,354 @@
+#include "rosban_utils/compression.h"
+
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+namespace rosban_utils
+{
+
+namespace
+{
+
+const char lz_magic[4] = {'R', 'B', 'L', 'Z'};
+const int lz_version = 1;
+/// Flag set on compressed size for blocks stored without compression
+const uint32_t stored_flag = 1u << 31;
+
+/// Matches are at least 4 bytes long
+const size_t min_match = 4;
+/// Offsets are stored on 2 bytes
+const size_t max_offset = 65535;
+/// Last bytes of a block are always literals, so that matches never read
+/// after the end of input
+const size_t last_literals = 8;
+const int hash_log = 16;
+
+inline uint32_t read32(const char * ptr)
+{
+  uint32_t value;
+  std::memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+
+inline uint32_t hash(uint32_t sequence)
+{
+  return (sequence * 2654435761u) >> (32 - hash_log);
+}
+
+/// Write a length exceeding the 4 bits of the token
+inline char * writeLength(char * op, size_t length)
+{
+  while (length >= 255) {
+    *op++ = (char)255;
+    length -= 255;
+  }
+  *op++ = (char)length;
+  return op;
+}
+
+/// Write literals and optionally a match
+inline char * writeSequence(char * op, const char * literals, size_t nb_literals,
+                            size_t offset, size_t match_length)
+{
+  char * token = op++;
+  size_t literal_code = nb_literals < 15 ? nb_literals : 15;
+  if (nb_literals >= 15) op = writeLength(op, nb_literals - 15);
+  if (nb_literals > 0) std::memcpy(op, literals, nb_literals);
+  op += nb_literals;
+  *token = (char)(literal_code << 4);
+  if (match_length == 0) return op;
+  *op++ = (char)(offset & 0xff);
+  *op++ = (char)(offset >> 8);
+  size_t match_code = match_length - min_match;
+  if (match_code >= 15) {
+    op = writeLength(op, match_code - 15);
+    match_code = 15;
+  }
+  *token |= (char)match_code;
+  return op;
+}
+
+/// Read an extended length, checking bounds
+inline size_t readLength(const unsigned char *& ip, const unsigned char * iend)
+{
+  size_t length = 0;
+  unsigned char byte;
+  do {
+    if (ip >= iend) {
+      throw std::runtime_error("lzDecompress: corrupted data (truncated length)");
+    }
+    byte = *ip++;
+    length += byte;
+  } while (byte == 255);
+  return length;
+}
+
+}
+
+size_t lzCompressBound(size_t size)
+{
+  return size + size / 255 + 16;
+}
+
+size_t lzCompress(const char * src, size_t size, char * dst)
+{
+  const char * ip = src;
+  const char * anchor = src;
+  const char * iend = src + size;
+  char * op = dst;
+  if (size > last_literals + min_match) {
+    // Position + 1 of the last occurrence of each hash, 0 if none
+    std::vector<uint32_t> table(1 << hash_log, 0);
+    const char * match_limit = iend - last_literals;
+    while (ip + min_match <= match_limit) {
+      // Search a match, skipping faster in data which does not compress
+      const char * match = nullptr;
+      size_t nb_attempts = 0;
+      while (ip + min_match <= match_limit) {
+        uint32_t sequence = read32(ip);
+        uint32_t h = hash(sequence);
+        uint32_t candidate = table[h];
+        table[h] = (ip - src) + 1;
+        if (candidate > 0) {
+          const char * ref = src + candidate - 1;
+          if ((size_t)(ip - ref) <= max_offset && read32(ref) == sequence) {
+            match = ref;
+            break;
+          }
+        }
+        ip += 1 + (nb_attempts++ >> 6);
+      }
+      if (!match) break;
+      // Extending backward and forward
+      while (ip > anchor && match > src && ip[-1] == match[-1]) {
+        ip--;
+        match--;
+      }
+      size_t length = min_match;
+      // Comparing 8 bytes at once
+      while (ip + length + sizeof(uint64_t) <= match_limit) {
+        uint64_t a, b;
+        std::memcpy(&a, ip + length, sizeof(a));
+        std::memcpy(&b, match + length, sizeof(b));
+        if (a != b) {
+          length += __builtin_ctzll(a ^ b) / 8;
+          break;
+        }
+        length += sizeof(uint64_t);
+      }
+      while (ip + length < match_limit && ip[length] == match[length]) {
+        length++;
+      }
+      op = writeSequence(op, anchor, ip - anchor, ip - match, length);
+      ip += length;
+      anchor = ip;
+      // Referencing the end of the match helps in repetitive data
+      if (ip + min_match <= match_limit) {
+        table[hash(read32(ip - 2))] = (ip - 2 - src) + 1;
+      }
+    }
+  }
+  // Remaining bytes are literals
+  op = writeSequence(op, anchor, iend - anchor, 0, 0);
+  return op - dst;
+}
+
+void lzDecompress(const char * src, size_t compressed_size, char * dst, size_t raw_size)
+{
+  const unsigned char * ip = reinterpret_cast<const unsigned char *>(src);
+  const unsigned char * iend = ip + compressed_size;
+  char * op = dst;
+  char * oend = dst + raw_size;
+  while (ip < iend) {
+    unsigned char token = *ip++;
+    size_t nb_literals = token >> 4;
+    if (nb_literals == 15) nb_literals += readLength(ip, iend);
+    if (nb_literals > (size_t)(iend - ip) || nb_literals > (size_t)(oend - op)) {
+      throw std::runtime_error("lzDecompress: corrupted data (literals out of bounds)");
+    }
+    if (nb_literals > 0) std::memcpy(op, ip, nb_literals);
+    ip += nb_literals;
+    op += nb_literals;
+    // Last sequence has no match
+    if (ip == iend) break;
+    if (iend - ip < 2) {
+      throw std::runtime_error("lzDecompress: corrupted data (truncated offset)");
+    }
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    size_t length = token & 15;
+    if (length == 15) length += readLength(ip, iend);
+    length += min_match;
+    if (offset == 0 || offset > (size_t)(op - dst) || length > (size_t)(oend - op)) {
+      throw std::runtime_error("lzDecompress: corrupted data (match out of bounds)");
+    }
+    const char * match = op - offset;
+    if (offset >= length) {
+      std::memcpy(op, match, length);
+      op += length;
+    }
+    else if (offset >= sizeof(uint64_t)) {
+      // Overlapping copy repeats the pattern, chunks of 8 bytes do not overlap
+      size_t i = 0;
+      for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+        std::memcpy(op + i, match + i, sizeof(uint64_t));
+      }
+      for (; i < length; i++) op[i] = match[i];
+      op += length;
+    }
+    else {
+      for (size_t i = 0; i < length; i++) *op++ = *match++;
+    }
+  }
+  if (op != oend) {
+    std::ostringstream oss;
+    oss << "lzDecompress: corrupted data, " << (op - dst) << " bytes decompressed instead of "
+        << raw_size;
+    throw std::runtime_error(oss.str());
+  }
+}
+
+bool isLZCompressed(const char * data, size_t size)
+{
+  if (size < sizeof(lz_magic) + sizeof(int)) return false;
+  int version;
+  std::memcpy(&version, data + sizeof(lz_magic), sizeof(int));
+  return std::memcmp(data, lz_magic, sizeof(lz_magic)) == 0 && version == lz_version;
+}
+
+LZOutputBuffer::LZOutputBuffer(std::ostream & output)
+  : out(output), block(LZ_BLOCK_SIZE), block_used(0), compressed(lzCompressBound(LZ_BLOCK_SIZE)),
+    nb_compressed_bytes(0), is_closed(false)
+{
+  out.write(lz_magic, sizeof(lz_magic));
+  out.write(reinterpret_cast<const char *>(&lz_version), sizeof(int));
+  nb_compressed_bytes += sizeof(lz_magic) + sizeof(int);
+}
+
+LZOutputBuffer::~LZOutputBuffer()
+{
+  // Errors can only be handled by calling close explicitly
+  try {
+    close();
+  }
+  catch (const std::runtime_error & exc) {
+  }
+}
+
+void LZOutputBuffer::close()
+{
+  if (is_closed) return;
+  is_closed = true;
+  if (block_used > 0) writeBlock();
+  uint32_t end_marker[2] = {0, 0};
+  out.write(reinterpret_cast<const char *>(end_marker), sizeof(end_marker));
+  nb_compressed_bytes += sizeof(end_marker);
+  out.flush();
+  if (!out) {
+    throw std::runtime_error("LZOutputBuffer::close: failed to write compressed data");
+  }
+}
+
+size_t LZOutputBuffer::getNbCompressedBytes() const
+{
+  return nb_compressed_bytes;
+}
+
+LZOutputBuffer::int_type LZOutputBuffer::overflow(int_type c)
+{
+  if (!traits_type::eq_int_type(c, traits_type::eof())) {
+    char value = traits_type::to_char_type(c);
+    xsputn(&value, 1);
+  }
+  return traits_type::not_eof(c);
+}
+
+std::streamsize LZOutputBuffer::xsputn(const char * s, std::streamsize n)
+{
+  if (is_closed) {
+    throw std::logic_error("LZOutputBuffer::xsputn: buffer has been closed");
+  }
+  std::streamsize written = 0;
+  while (written < n) {
+    size_t chunk = std::min((size_t)(n - written), block.size() - block_used);
+    std::memcpy(block.data() + block_used, s + written, chunk);
+    block_used += chunk;
+    written += chunk;
+    if (block_used == block.size()) writeBlock();
+  }
+  return n;
+}
+
+void LZOutputBuffer::writeBlock()
+{
+  uint32_t sizes[2];
+  sizes[0] = lzCompress(block.data(), block_used, compressed.data());
+  sizes[1] = block_used;
+  const char * data = compressed.data();
+  // Incompressible data is stored as is
+  if (sizes[0] >= block_used) {
+    sizes[0] = block_used | stored_flag;
+    data = block.data();
+  }
+  size_t data_size = sizes[0] & ~stored_flag;
+  out.write(reinterpret_cast<const char *>(sizes), sizeof(sizes));
+  out.write(data, data_size);
+  nb_compressed_bytes += sizeof(sizes) + data_size;
+  block_used = 0;
+  if (!out) {
+    throw std::runtime_error("LZOutputBuffer::writeBlock: failed to write compressed data");
+  }
+}
+
+LZInputBuffer::LZInputBuffer(BinaryReader & input)
+  : in(input), is_finished(false)
+{
+  char header[sizeof(lz_magic) + sizeof(int)];
+  in.readRaw(header, sizeof(header));
+  if (!isLZCompressed(header, sizeof(header))) {
+    throw std::runtime_error("LZInputBuffer: data is not compressed");
+  }
+}
+
+LZInputBuffer::int_type LZInputBuffer::underflow()
+{
+  if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+  if (is_finished || !readBlock()) return traits_type::eof();
+  setg(block.data(), block.data(), block.data() + block.size());
+  return traits_type::to_int_type(*gptr());
+}
+
+bool LZInputBuffer::readBlock()
+{
+  uint32_t sizes[2];
+  in.readArray<uint32_t>(sizes, 2);
+  size_t raw_size = sizes[1];
+  if (raw_size == 0) {
+    is_finished = true;
+    return false;
+  }
+  size_t data_size = sizes[0] & ~stored_flag;
+  if (raw_size > LZ_BLOCK_SIZE || data_size > lzCompressBound(LZ_BLOCK_SIZE)) {
+    throw std::runtime_error("LZInputBuffer::readBlock: corrupted data (invalid block size)");
+  }
+  block.resize(raw_size);
+  if (sizes[0] & stored_flag) {
+    if (data_size != raw_size) {
+      throw std::runtime_error("LZInputBuffer::readBlock: corrupted data (invalid stored block)");
+    }
+    in.readRaw(block.data(), raw_size);
+    return true;
+  }
+  // Compressed data is accessed without copy when reading from memory
+  const char * data = in.getArray<char>(data_size);
+  if (!data) {
+    compressed.resize(data_size);
+    in.readRaw(compressed.data(), data_size);
+    data = compressed.data();
+  }
+  lzDecompress(data, data_size, block.data(), raw_size);
+  return true;
+}
+
+}
@@ -1,6 +1,11 @@
 #include "rosban_utils/io_tools.h"
 
+#include "rosban_utils/mapped_file.h"
+
+#include <algorithm>
+#include <cmath>
 #include <fstream>
+#include <sstream>
 #include <stdexcept>
 
 #include <iostream>
@@ -76,4 +81,889 @@ int readDoubleArray(std::istream & in, double * values, int nb_values)
   return bytes_to_read;
 }
 
+BinaryWriter::BinaryWriter()
+  : out(nullptr), begin(nullptr), capacity(0), is_fixed(false), used(0), nb_flushed_bytes(0)
+{
+}
+
+BinaryWriter::BinaryWriter(std::ostream & output, size_t buffer_size)
+  : out(&output), buffer(std::max(buffer_size, (size_t)64)), begin(buffer.data()),
+    capacity(buffer.size()), is_fixed(false), used(0), nb_flushed_bytes(0)
+{
+}
+
+BinaryWriter::BinaryWriter(char * data, size_t size)
+  : out(nullptr), begin(data), capacity(size), is_fixed(true), used(0), nb_flushed_bytes(0)
+{
+}
+
+BinaryWriter::~BinaryWriter()
+{
+  // Errors can only be handled by calling flush explicitly
+  try {
+    flush();
+  }
+  catch (const std::runtime_error & exc) {
+  }
+}
+
+void BinaryWriter::flush()
+{
+  if (!out || used == 0) return;
+  out->write(begin, used);
+  nb_flushed_bytes += used;
+  used = 0;
+  if (!*out) {
+    throw std::runtime_error("BinaryWriter::flush: failed to write to stream");
+  }
+}
+
+void BinaryWriter::clear()
+{
+  nb_flushed_bytes += used;
+  used = 0;
+}
+
+const char * BinaryWriter::getData() const
+{
+  return begin;
+}
+
+size_t BinaryWriter::getSize() const
+{
+  return used;
+}
+
+size_t BinaryWriter::getNbBytesWritten() const
+{
+  return nb_flushed_bytes + used;
+}
+
+void BinaryWriter::makeRoom(size_t nb_bytes)
+{
+  if (is_fixed) {
+    std::ostringstream oss;
+    oss << "BinaryWriter::makeRoom: cannot write " << nb_bytes << " bytes, only "
+        << (capacity - used) << " bytes left in external memory";
+    throw std::runtime_error(oss.str());
+  }
+  if (out) {
+    flush();
+    if (capacity >= nb_bytes) return;
+  }
+  // Growing geometrically to keep amortized constant cost
+  size_t new_size = std::max(capacity * 2, (size_t)4096);
+  while (new_size - used < nb_bytes) new_size *= 2;
+  buffer.resize(new_size);
+  begin = buffer.data();
+  capacity = buffer.size();
+}
+
+int BinaryWriter::writeLarge(const char * data, size_t nb_bytes)
+{
+  // Large blocks are sent directly to the stream
+  if (out && nb_bytes >= capacity / 2) {
+    flush();
+    out->write(data, nb_bytes);
+    nb_flushed_bytes += nb_bytes;
+    if (!*out) {
+      throw std::runtime_error("BinaryWriter::writeLarge: failed to write to stream");
+    }
+    return nb_bytes;
+  }
+  makeRoom(nb_bytes);
+  std::memcpy(begin + used, data, nb_bytes);
+  used += nb_bytes;
+  return nb_bytes;
+}
+
+BinaryReader::BinaryReader(std::istream & input, size_t buffer_size)
+  : in(&input), buffer(std::max(buffer_size, (size_t)64)), pos(buffer.data()), end(buffer.data()),
+    nb_previous_bytes(0), start(buffer.data()), mapped_file(nullptr)
+{
+}
+
+BinaryReader::BinaryReader(const char * data, size_t size)
+  : in(nullptr), pos(data), end(data + size), nb_previous_bytes(0), start(data),
+    mapped_file(nullptr)
+{
+}
+
+BinaryReader::BinaryReader(const char * data, size_t size, std::shared_ptr<const void> o)
+  : in(nullptr), pos(data), end(data + size), nb_previous_bytes(0), start(data), owner(o),
+    mapped_file(nullptr)
+{
+}
+
+BinaryReader::BinaryReader(std::shared_ptr<const MappedFile> file)
+  : in(nullptr), pos(file->getData()), end(file->getData() + file->getSize()),
+    nb_previous_bytes(0), start(file->getData()), owner(file), mapped_file(file.get())
+{
+}
+
+std::shared_ptr<const void> BinaryReader::getOwner() const
+{
+  return owner;
+}
+
+const char * BinaryReader::getPointer(size_t nb_bytes)
+{
+  if ((size_t)(end - pos) < nb_bytes) fill(nb_bytes);
+  const char * result = pos;
+  pos += nb_bytes;
+  return result;
+}
+
+const char * BinaryReader::peek(size_t * nb_bytes)
+{
+  if (pos == end && in) {
+    nb_previous_bytes += pos - start;
+    in->read(buffer.data(), buffer.size());
+    pos = buffer.data();
+    end = pos + in->gcount();
+    start = pos;
+  }
+  *nb_bytes = end - pos;
+  return pos;
+}
+
+void BinaryReader::skip(size_t nb_bytes)
+{
+  if ((size_t)(end - pos) < nb_bytes) {
+    throw std::logic_error("BinaryReader::skip: skipping bytes which are not available");
+  }
+  pos += nb_bytes;
+}
+
+bool BinaryReader::isEnd()
+{
+  size_t available;
+  peek(&available);
+  return available == 0;
+}
+
+size_t BinaryReader::getNbBytesRead() const
+{
+  return nb_previous_bytes + (pos - start);
+}
+
+void BinaryReader::fill(size_t nb_bytes)
+{
+  size_t available = end - pos;
+  if (available >= nb_bytes) return;
+  if (in) {
+    // Moving remaining data to the beginning of the buffer before growing it,
+    // since growing invalidates pos
+    nb_previous_bytes += pos - start;
+    std::memmove(buffer.data(), pos, available);
+    if (buffer.size() < nb_bytes) buffer.resize(nb_bytes);
+    in->read(buffer.data() + available, buffer.size() - available);
+    pos = buffer.data();
+    end = pos + available + in->gcount();
+    start = pos;
+    available = end - pos;
+  }
+  if (available < nb_bytes) {
+    std::ostringstream oss;
+    oss << "BinaryReader::fill: unexpected end of data, " << nb_bytes << " bytes required, "
+        << available << " bytes available";
+    throw std::runtime_error(oss.str());
+  }
+}
+
+int BinaryReader::readLarge(char * data, size_t nb_bytes)
+{
+  size_t available = end - pos;
+  // Large blocks are read directly from the stream
+  if (in && nb_bytes > available && nb_bytes - available >= buffer.size() / 2) {
+    std::memcpy(data, pos, available);
+    pos += available;
+    in->read(data + available, nb_bytes - available);
+    size_t nb_read = in->gcount();
+    nb_previous_bytes += nb_read;
+    if (nb_read < nb_bytes - available) {
+      std::ostringstream oss;
+      oss << "BinaryReader::readLarge: unexpected end of data, " << nb_bytes
+          << " bytes required, " << (available + nb_read) << " bytes available";
+      throw std::runtime_error(oss.str());
+    }
+    return nb_bytes;
+  }
+  fill(nb_bytes);
+  if (mapped_file) {
+    // Copying by blocks and releasing them, thus the file and the copy are
+    // never both entirely in memory
+    for (size_t offset = 0; offset < nb_bytes; offset += LARGE_BLOCK_SIZE) {
+      size_t block_size = std::min((size_t)LARGE_BLOCK_SIZE, nb_bytes - offset);
+      std::memcpy(data + offset, pos, block_size);
+      mapped_file->release(pos - mapped_file->getData(), block_size);
+      pos += block_size;
+    }
+    return nb_bytes;
+  }
+  std::memcpy(data, pos, nb_bytes);
+  pos += nb_bytes;
+  return nb_bytes;
+}
+
+BinaryWriterBuffer::BinaryWriterBuffer(BinaryWriter & w)
+  : writer(w)
+{
+}
+
+BinaryWriterBuffer::int_type BinaryWriterBuffer::overflow(int_type c)
+{
+  if (!traits_type::eq_int_type(c, traits_type::eof())) {
+    writer.write<char>(traits_type::to_char_type(c));
+  }
+  return traits_type::not_eof(c);
+}
+
+std::streamsize BinaryWriterBuffer::xsputn(const char * s, std::streamsize n)
+{
+  writer.writeRaw(s, n);
+  return n;
+}
+
+CountingBuffer::CountingBuffer()
+  : count(0)
+{
+}
+
+size_t CountingBuffer::getCount() const
+{
+  return count;
+}
+
+CountingBuffer::int_type CountingBuffer::overflow(int_type c)
+{
+  if (!traits_type::eq_int_type(c, traits_type::eof())) {
+    count++;
+  }
+  return traits_type::not_eof(c);
+}
+
+std::streamsize CountingBuffer::xsputn(const char *, std::streamsize n)
+{
+  count += n;
+  return n;
+}
+
+BinaryReaderBuffer::BinaryReaderBuffer(BinaryReader & r)
+  : reader(r)
+{
+}
+
+BinaryReaderBuffer::~BinaryReaderBuffer()
+{
+  sync();
+}
+
+BinaryReaderBuffer::int_type BinaryReaderBuffer::underflow()
+{
+  sync();
+  size_t available;
+  const char * data = reader.peek(&available);
+  if (available == 0) return traits_type::eof();
+  // Data is exposed without being consumed, see sync
+  char * begin = const_cast<char *>(data);
+  setg(begin, begin, begin + available);
+  return traits_type::to_int_type(*begin);
+}
+
+std::streamsize BinaryReaderBuffer::xsgetn(char * s, std::streamsize n)
+{
+  sync();
+  // Reading by chunks to stop at the end of data, as std::streambuf would
+  std::streamsize nb_read = 0;
+  while (nb_read < n) {
+    size_t available;
+    reader.peek(&available);
+    if (available == 0) break;
+    size_t chunk = std::min((size_t)(n - nb_read), available);
+    reader.readRaw(s + nb_read, chunk);
+    nb_read += chunk;
+  }
+  return nb_read;
+}
+
+int BinaryReaderBuffer::sync()
+{
+  // Consuming the bytes extracted from the stream
+  if (gptr() != nullptr) {
+    reader.skip(gptr() - eback());
+  }
+  setg(nullptr, nullptr, nullptr);
+  return 0;
+}
+
+int writeVectors(BinaryWriter & out, const std::vector<Eigen::VectorXd> & vectors)
+{
+  int bytes_written = 0;
+  int dim = vectors.size() > 0 ? vectors[0].size() : 0;
+  for (const Eigen::VectorXd & vector : vectors) {
+    if (vector.size() != dim) {
+      dim = -1;
+      break;
+    }
+  }
+  bytes_written += out.write<int>(vectors.size());
+  bytes_written += out.write<int>(dim);
+  if (dim < 0) {
+    for (const Eigen::VectorXd & vector : vectors) {
+      bytes_written += out.write<int>(vector.size());
+    }
+  }
+  for (const Eigen::VectorXd & vector : vectors) {
+    bytes_written += out.writeArray<double>(vector.data(), vector.size());
+  }
+  return bytes_written;
+}
+
+int writeVectors(std::ostream & out, const std::vector<Eigen::VectorXd> & vectors)
+{
+  BinaryWriter writer(out);
+  int bytes_written = writeVectors(writer, vectors);
+  writer.flush();
+  return bytes_written;
+}
+
+namespace
+{
+
+/// Read the header written by writeVectors and resize the vectors
+template <typename In>
+int readVectorsHeader(In & in, std::vector<Eigen::VectorXd> * vectors)
+{
+  int bytes_read = 0;
+  int nb_vectors, dim;
+  bytes_read += read<int>(in, &nb_vectors);
+  bytes_read += read<int>(in, &dim);
+  if (nb_vectors < 0 || dim < -1) {
+    std::ostringstream oss;
+    oss << "readVectors: invalid header, " << nb_vectors << " vectors of dimension " << dim;
+    throw std::runtime_error(oss.str());
+  }
+  vectors->resize(nb_vectors);
+  for (int vector_idx = 0; vector_idx < nb_vectors; vector_idx++) {
+    int vector_dim = dim;
+    if (dim < 0) {
+      bytes_read += read<int>(in, &vector_dim);
+      if (vector_dim < 0) {
+        throw std::runtime_error("readVectors: negative dimension");
+      }
+    }
+    // No allocation if the size does not change
+    (*vectors)[vector_idx].resize(vector_dim);
+  }
+  return bytes_read;
+}
+
+}
+
+int readVectors(BinaryReader & in, std::vector<Eigen::VectorXd> * vectors)
+{
+  int bytes_read = readVectorsHeader(in, vectors);
+  for (Eigen::VectorXd & vector : *vectors) {
+    bytes_read += in.readArray<double>(vector.data(), vector.size());
+  }
+  return bytes_read;
+}
+
+int readVectors(std::istream & in, std::vector<Eigen::VectorXd> * vectors)
+{
+  int bytes_read = readVectorsHeader(in, vectors);
+  for (Eigen::VectorXd & vector : *vectors) {
+    bytes_read += readArray<double>(in, vector.size(), vector.data());
+  }
+  return bytes_read;
+}
+
+namespace
+{
+
+/// Values are transformed by blocks of fixed size in loops over arrays which
+/// do not alias, GCC vectorizes the zig-zag, difference and XOR transforms
+/// from -O2 (the last block is padded with zeros). Rounding and conversions
+/// between doubles and 64-bit integers require more than SSE2 and remain
+/// scalar, as do the variable length packing and the prefix sums
+const int codec_block_size = 256;
+
+/// Map signed values stored in two's complement to unsigned values with
+/// small absolute values giving small results: 0, -1, 1, -2... -> 0, 1, 2, 3...
+template <typename U>
+inline U zigZag(U value)
+{
+  return (value << 1) ^ (U(0) - (value >> (8 * sizeof(U) - 1)));
+}
+
+template <typename U>
+inline U unZigZag(U value)
+{
+  return (value >> 1) ^ (U(0) - (value & 1));
+}
+
+/// Zig-zag encoding of the codec_block_size values
+template <typename U>
+void zigZagBlock(const U * __restrict values, U * __restrict encoded)
+{
+  for (int i = 0; i < codec_block_size; i++) {
+    encoded[i] = zigZag<U>(values[i]);
+  }
+}
+
+/// Zig-zag encoding of the differences between the codec_block_size + 1
+/// values of 'shifted'
+template <typename U>
+void zigZagDeltaBlock(const U * __restrict shifted, U * __restrict encoded)
+{
+  for (int i = 0; i < codec_block_size; i++) {
+    encoded[i] = zigZag<U>(shifted[i + 1] - shifted[i]);
+  }
+}
+
+template <typename U>
+void unZigZagBlock(U * __restrict values)
+{
+  for (int i = 0; i < codec_block_size; i++) {
+    values[i] = unZigZag<U>(values[i]);
+  }
+}
+
+/// XOR of the consecutive values of the codec_block_size + 1 values of 'shifted'
+void xorDeltaBlock(const uint64_t * __restrict shifted, uint64_t * __restrict xors)
+{
+  for (int i = 0; i < codec_block_size; i++) {
+    xors[i] = shifted[i + 1] ^ shifted[i];
+  }
+}
+
+/// Copy 'block_size' values to 'dst' and pad it with zeros up to codec_block_size
+template <typename T, typename U>
+void loadBlock(const T * src, int block_size, U * dst)
+{
+  static_assert(sizeof(T) == sizeof(U), "loadBlock: types should have the same size");
+  std::memcpy(dst, src, block_size * sizeof(T));
+  std::fill(dst + block_size, dst + codec_block_size, 0);
+}
+
+/// Write 7 bits per byte, the highest bit tells if more bytes follow
+template <typename U>
+inline char * packVarInt(U value, char * dst)
+{
+  while (value >= 0x80) {
+    *dst++ = (char)(value | 0x80);
+    value >>= 7;
+  }
+  *dst++ = (char)value;
+  return dst;
+}
+
+template <typename U>
+inline const char * unpackVarInt(const char * src, const char * end, U * value)
+{
+  // Most values are expected to fit in a single byte
+  if (src != end && (uint8_t)*src < 0x80) {
+    *value = (uint8_t)*src;
+    return src + 1;
+  }
+  U result = 0;
+  for (int shift = 0; ; shift += 7) {
+    if (src == end || shift >= (int)(8 * sizeof(U))) {
+      throw std::runtime_error("unpackVarInt: truncated or invalid data");
+    }
+    uint8_t byte = *src++;
+    result |= (U)(byte & 0x7f) << shift;
+    if (byte < 0x80) break;
+  }
+  *value = result;
+  return src;
+}
+
+/// Encoded data is built in a buffer reused by each thread
+char * getCodecBuffer(size_t size)
+{
+  static thread_local std::vector<char> buffer;
+  if (buffer.size() < size) buffer.resize(size);
+  return buffer.data();
+}
+
+void checkEncodedSize(const char * pos, const char * end, const char * function)
+{
+  if (pos != end) {
+    std::ostringstream oss;
+    oss << function << ": " << (end - pos) << " bytes of encoded data left after decoding";
+    throw std::runtime_error(oss.str());
+  }
+}
+
+/// Differences are computed with unsigned arithmetic, overflows are thus
+/// well defined and reverted when decoding
+size_t encodeInts(const int * values, int nb_values, bool delta, char * dst)
+{
+  char * pos = dst;
+  // Last value of the previous block followed by the values of the block
+  uint32_t shifted[codec_block_size + 1];
+  uint32_t encoded[codec_block_size];
+  shifted[0] = 0;
+  for (int block_start = 0; block_start < nb_values; block_start += codec_block_size) {
+    int block_size = std::min(codec_block_size, nb_values - block_start);
+    loadBlock(values + block_start, block_size, shifted + 1);
+    if (delta) {
+      zigZagDeltaBlock(shifted, encoded);
+    }
+    else {
+      zigZagBlock(shifted + 1, encoded);
+    }
+    shifted[0] = shifted[block_size];
+    for (int i = 0; i < block_size; i++) {
+      pos = packVarInt(encoded[i], pos);
+    }
+  }
+  return pos - dst;
+}
+
+void decodeInts(const char * src, size_t size, bool delta, int * values, int nb_values)
+{
+  const char * pos = src;
+  const char * end = src + size;
+  // Values after the end of the last block are not used
+  uint32_t decoded[codec_block_size] = {};
+  uint32_t previous = 0;
+  for (int block_start = 0; block_start < nb_values; block_start += codec_block_size) {
+    int block_size = std::min(codec_block_size, nb_values - block_start);
+    int * block = values + block_start;
+    for (int i = 0; i < block_size; i++) {
+      pos = unpackVarInt(pos, end, &decoded[i]);
+    }
+    unZigZagBlock(decoded);
+    if (delta) {
+      for (int i = 0; i < block_size; i++) {
+        previous += decoded[i];
+        block[i] = (int)previous;
+      }
+    }
+    else {
+      std::memcpy(block, decoded, block_size * sizeof(int));
+    }
+  }
+  checkEncodedSize(pos, end, "decodeInts");
+}
+
+/// Each value is written as a control byte containing the number of trailing
+/// zero bytes (high nibble) and of significant bytes (low nibble) of the XOR
+/// with the previous value, followed by the significant bytes
+size_t encodeXorDoubles(const double * values, int nb_values, char * dst)
+{
+  char * pos = dst;
+  // Bits of the last value of the previous block followed by the block
+  uint64_t shifted[codec_block_size + 1];
+  uint64_t xors[codec_block_size];
+  shifted[0] = 0;
+  for (int block_start = 0; block_start < nb_values; block_start += codec_block_size) {
+    int block_size = std::min(codec_block_size, nb_values - block_start);
+    loadBlock(values + block_start, block_size, shifted + 1);
+    xorDeltaBlock(shifted, xors);
+    shifted[0] = shifted[block_size];
+    for (int i = 0; i < block_size; i++) {
+      uint64_t value = xors[i];
+      if (value == 0) {
+        *pos++ = 0;
+        continue;
+      }
+      int trailing = __builtin_ctzll(value) / 8;
+      int nb_bytes = 8 - trailing - __builtin_clzll(value) / 8;
+      *pos++ = (char)(trailing << 4 | nb_bytes);
+      value >>= 8 * trailing;
+      // The 8 bytes are always copied, the destination has room for it
+      std::memcpy(pos, &value, sizeof(value));
+      pos += nb_bytes;
+    }
+  }
+  return pos - dst;
+}
+
+void decodeXorDoubles(const char * src, size_t size, double * values, int nb_values)
+{
+  const char * pos = src;
+  const char * end = src + size;
+  uint64_t bits[codec_block_size];
+  uint64_t previous = 0;
+  for (int block_start = 0; block_start < nb_values; block_start += codec_block_size) {
+    int block_size = std::min(codec_block_size, nb_values - block_start);
+    for (int i = 0; i < block_size; i++) {
+      if (pos == end) {
+        throw std::runtime_error("decodeXorDoubles: truncated data");
+      }
+      uint8_t control = *pos++;
+      int trailing = control >> 4;
+      int nb_bytes = control & 0xf;
+      if (trailing + nb_bytes > 8 || (nb_bytes == 0 && trailing != 0) ||
+          nb_bytes > end - pos) {
+        throw std::runtime_error("decodeXorDoubles: truncated or invalid data");
+      }
+      uint64_t value = 0;
+      std::memcpy(&value, pos, nb_bytes);
+      pos += nb_bytes;
+      previous ^= value << (8 * trailing);
+      bits[i] = previous;
+    }
+    std::memcpy(values + block_start, bits, block_size * sizeof(double));
+  }
+  checkEncodedSize(pos, end, "decodeXorDoubles");
+}
+
+/// The step (double) is followed by the DeltaInt encoding of the multiples
+size_t encodeQuantizedDoubles(const double * values, int nb_values, double tolerance, char * dst)
+{
+  if (!(tolerance > 0)) {
+    std::ostringstream oss;
+    oss << "encodeQuantizedDoubles: tolerance should be strictly positive, received " << tolerance;
+    throw std::logic_error(oss.str());
+  }
+  // Multiples are stored on 64 bits, a margin is kept for differences
+  const double max_multiple = std::ldexp(1.0, 62);
+  double step = 2 * tolerance;
+  double inv_step = 1 / step;
+  char * pos = dst;
+  std::memcpy(pos, &step, sizeof(step));
+  pos += sizeof(step);
+  double scaled[codec_block_size];
+  // Last multiple of the previous block followed by the multiples of the block
+  uint64_t multiples[codec_block_size + 1] = {};
+  uint64_t encoded[codec_block_size];
+  for (int block_start = 0; block_start < nb_values; block_start += codec_block_size) {
+    int block_size = std::min(codec_block_size, nb_values - block_start);
+    const double * block = values + block_start;
+    bool is_valid = true;
+    for (int i = 0; i < block_size; i++) {
+      scaled[i] = std::round(block[i] * inv_step);
+      // Also false for NaN
+      is_valid &= std::fabs(scaled[i]) < max_multiple;
+    }
+    if (!is_valid) {
+      std::ostringstream oss;
+      oss << "encodeQuantizedDoubles: a value in [" << block_start << ","
+          << (block_start + block_size) << "[ is not finite or too large for tolerance "
+          << tolerance;
+      throw std::runtime_error(oss.str());
+    }
+    for (int i = 0; i < block_size; i++) {
+      multiples[i + 1] = (uint64_t)(int64_t)scaled[i];
+    }
+    std::fill(multiples + block_size + 1, multiples + codec_block_size + 1, 0);
+    zigZagDeltaBlock(multiples, encoded);
+    multiples[0] = multiples[block_size];
+    for (int i = 0; i < block_size; i++) {
+      pos = packVarInt(encoded[i], pos);
+    }
+  }
+  return pos - dst;
+}
+
+void decodeQuantizedDoubles(const char * src, size_t size, double * values, int nb_values)
+{
+  const char * pos = src;
+  const char * end = src + size;
+  double step;
+  if (size < sizeof(step)) {
+    throw std::runtime_error("decodeQuantizedDoubles: truncated data");
+  }
+  std::memcpy(&step, pos, sizeof(step));
+  pos += sizeof(step);
+  // Values after the end of the last block are not used
+  uint64_t decoded[codec_block_size] = {};
+  uint64_t previous = 0;
+  for (int block_start = 0; block_start < nb_values; block_start += codec_block_size) {
+    int block_size = std::min(codec_block_size, nb_values - block_start);
+    double * block = values + block_start;
+    for (int i = 0; i < block_size; i++) {
+      pos = unpackVarInt(pos, end, &decoded[i]);
+    }
+    unZigZagBlock(decoded);
+    for (int i = 0; i < block_size; i++) {
+      previous += decoded[i];
+      decoded[i] = previous;
+    }
+    for (int i = 0; i < block_size; i++) {
+      block[i] = (int64_t)decoded[i] * step;
+    }
+  }
+  checkEncodedSize(pos, end, "decodeQuantizedDoubles");
+}
+
+/// Write the size of the encoded data and the data produced by 'encode'
+/// which should not exceed 'max_size'
+template <typename Out, typename Encoder>
+int writeEncoded(Out & out, size_t max_size, Encoder encode)
+{
+  char * buffer = getCodecBuffer(max_size);
+  size_t size = encode(buffer);
+  int bytes_written = 0;
+  bytes_written += write<int>(out, size);
+  bytes_written += writeArray<char>(out, size, buffer);
+  return bytes_written;
+}
+
+/// Encoded data is decoded directly from the memory of the reader
+template <typename Decoder>
+int readEncoded(BinaryReader & in, Decoder decode)
+{
+  int size = in.read<int>();
+  if (size < 0) {
+    throw std::runtime_error("readEncoded: negative size");
+  }
+  decode(in.getPointer(size), size);
+  return sizeof(int) + size;
+}
+
+template <typename Decoder>
+int readEncoded(std::istream & in, Decoder decode)
+{
+  int size;
+  read<int>(in, &size);
+  if (!in || size < 0) {
+    throw std::runtime_error("readEncoded: failed to read size");
+  }
+  char * buffer = getCodecBuffer(size);
+  in.read(buffer, size);
+  if (!in) {
+    throw std::runtime_error("readEncoded: failed to read encoded data");
+  }
+  decode(buffer, size);
+  return sizeof(int) + size;
+}
+
+template <typename Out>
+int writeInts(Out & out, const int * values, int nb_values, bool delta)
+{
+  return writeEncoded(out, 5 * (size_t)nb_values, [&](char * dst) {
+      return encodeInts(values, nb_values, delta, dst);
+    });
+}
+
+template <typename In>
+int readInts(In & in, int * values, int nb_values, bool delta)
+{
+  return readEncoded(in, [&](const char * src, size_t size) {
+      decodeInts(src, size, delta, values, nb_values);
+    });
+}
+
+template <typename Out>
+int writeXorDoubles(Out & out, const double * values, int nb_values)
+{
+  return writeEncoded(out, 9 * (size_t)nb_values, [&](char * dst) {
+      return encodeXorDoubles(values, nb_values, dst);
+    });
+}
+
+template <typename In>
+int readXorDoubles(In & in, double * values, int nb_values)
+{
+  return readEncoded(in, [&](const char * src, size_t size) {
+      decodeXorDoubles(src, size, values, nb_values);
+    });
+}
+
+template <typename Out>
+int writeQuantizedDoubles(Out & out, const double * values, int nb_values, double tolerance)
+{
+  return writeEncoded(out, sizeof(double) + 10 * (size_t)nb_values, [&](char * dst) {
+      return encodeQuantizedDoubles(values, nb_values, tolerance, dst);
+    });
+}
+
+template <typename In>
+int readQuantizedDoubles(In & in, double * values, int nb_values)
+{
+  return readEncoded(in, [&](const char * src, size_t size) {
+      decodeQuantizedDoubles(src, size, values, nb_values);
+    });
+}
+
+}
+
+int writeVarIntArray(BinaryWriter & out, const int * values, int nb_values)
+{
+  return writeInts(out, values, nb_values, false);
+}
+
+int writeVarIntArray(std::ostream & out, const int * values, int nb_values)
+{
+  return writeInts(out, values, nb_values, false);
+}
+
+int readVarIntArray(BinaryReader & in, int * values, int nb_values)
+{
+  return readInts(in, values, nb_values, false);
+}
+
+int readVarIntArray(std::istream & in, int * values, int nb_values)
+{
+  return readInts(in, values, nb_values, false);
+}
+
+int writeDeltaIntArray(BinaryWriter & out, const int * values, int nb_values)
+{
+  return writeInts(out, values, nb_values, true);
+}
+
+int writeDeltaIntArray(std::ostream & out, const int * values, int nb_values)
+{
+  return writeInts(out, values, nb_values, true);
+}
+
+int readDeltaIntArray(BinaryReader & in, int * values, int nb_values)
+{
+  return readInts(in, values, nb_values, true);
+}
+
+int readDeltaIntArray(std::istream & in, int * values, int nb_values)
+{
+  return readInts(in, values, nb_values, true);
+}
+
+int writeXorDoubleArray(BinaryWriter & out, const double * values, int nb_values)
+{
+  return writeXorDoubles(out, values, nb_values);
+}
+
+int writeXorDoubleArray(std::ostream & out, const double * values, int nb_values)
+{
+  return writeXorDoubles(out, values, nb_values);
+}
+
+int readXorDoubleArray(BinaryReader & in, double * values, int nb_values)
+{
+  return readXorDoubles(in, values, nb_values);
+}
+
+int readXorDoubleArray(std::istream & in, double * values, int nb_values)
+{
+  return readXorDoubles(in, values, nb_values);
+}
+
+int writeQuantizedDoubleArray(BinaryWriter & out, const double * values, int nb_values,
+                              double tolerance)
+{
+  return writeQuantizedDoubles(out, values, nb_values, tolerance);
+}
+
+int writeQuantizedDoubleArray(std::ostream & out, const double * values, int nb_values,
+                              double tolerance)
+{
+  return writeQuantizedDoubles(out, values, nb_values, tolerance);
+}
+
+int readQuantizedDoubleArray(BinaryReader & in, double * values, int nb_values)
+{
+  return readQuantizedDoubles(in, values, nb_values);
+}
+
+int readQuantizedDoubleArray(std::istream & in, double * values, int nb_values)
+{
+  return readQuantizedDoubles(in, values, nb_values);
+}
+
 }
@@ -0,0 +1,126 @@
+#include "rosban_utils/latency_histogram.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace rosban_utils
+{
+
+LatencyHistogram::LatencyHistogram()
+  : counts(NB_BUCKETS), nb_values(0), min_value(0), max_value(0)
+{
+  reset();
+}
+
+void LatencyHistogram::merge(const LatencyHistogram & other)
+{
+  // 'other' might be modified meanwhile, each of its fields is read once
+  uint64_t other_nb_values = other.nb_values.load(std::memory_order_relaxed);
+  if (other_nb_values == 0) return;
+  for (int bucket = 0; bucket < NB_BUCKETS; bucket++) {
+    counts[bucket].store(counts[bucket].load(std::memory_order_relaxed) +
+                         other.counts[bucket].load(std::memory_order_relaxed),
+                         std::memory_order_relaxed);
+  }
+  uint64_t other_min = other.min_value.load(std::memory_order_relaxed);
+  uint64_t other_max = other.max_value.load(std::memory_order_relaxed);
+  if (nb_values == 0 || other_min < min_value) min_value = other_min;
+  if (other_max > max_value) max_value = other_max;
+  nb_values += other_nb_values;
+}
+
+void LatencyHistogram::subtract(const LatencyHistogram & other)
+{
+  uint64_t other_nb_values = other.nb_values.load();
+  if (other_nb_values > nb_values) {
+    throw std::logic_error("LatencyHistogram::subtract: other has more values");
+  }
+  int first_bucket = -1;
+  int last_bucket = -1;
+  for (int bucket = 0; bucket < NB_BUCKETS; bucket++) {
+    uint64_t other_count = other.counts[bucket].load(std::memory_order_relaxed);
+    uint64_t count = counts[bucket].load(std::memory_order_relaxed);
+    if (other_count > count) {
+      throw std::logic_error("LatencyHistogram::subtract: other is not included in histogram");
+    }
+    counts[bucket].store(count - other_count, std::memory_order_relaxed);
+    if (count > other_count) {
+      if (first_bucket < 0) first_bucket = bucket;
+      last_bucket = bucket;
+    }
+  }
+  nb_values -= other_nb_values;
+  if (nb_values == 0) {
+    min_value = 0;
+    max_value = 0;
+    return;
+  }
+  min_value = std::max(min_value.load(), getBucketMin(first_bucket));
+  max_value = std::min(max_value.load(), getBucketMax(last_bucket));
+}
+
+void LatencyHistogram::reset()
+{
+  for (std::atomic<uint64_t> & count : counts) {
+    count.store(0, std::memory_order_relaxed);
+  }
+  nb_values = 0;
+  min_value = 0;
+  max_value = 0;
+}
+
+uint64_t LatencyHistogram::getNbValues() const
+{
+  return nb_values;
+}
+
+uint64_t LatencyHistogram::getMin() const
+{
+  return min_value;
+}
+
+uint64_t LatencyHistogram::getMax() const
+{
+  return max_value;
+}
+
+uint64_t LatencyHistogram::getPercentile(double percentile) const
+{
+  if (percentile < 0 || percentile > 100) {
+    throw std::logic_error("LatencyHistogram::getPercentile: percentile should be in [0,100]");
+  }
+  uint64_t nb = nb_values.load();
+  if (nb == 0) return 0;
+  // Rank of the requested value, starting at 1
+  uint64_t rank = std::max((uint64_t)1, (uint64_t)std::ceil(percentile / 100 * nb));
+  uint64_t min = min_value.load();
+  uint64_t max = max_value.load();
+  uint64_t cumulated = 0;
+  for (int bucket = 0; bucket < NB_BUCKETS; bucket++) {
+    cumulated += counts[bucket].load(std::memory_order_relaxed);
+    if (cumulated >= rank) {
+      return std::max(min, std::min(getBucketMax(bucket), max));
+    }
+  }
+  return max;
+}
+
+uint64_t LatencyHistogram::getBucketMin(int bucket)
+{
+  if (bucket < NB_SUB_BUCKETS) return bucket;
+  int shift = bucket / NB_SUB_BUCKETS - 1;
+  uint64_t sub_bucket = bucket % NB_SUB_BUCKETS + NB_SUB_BUCKETS;
+  return sub_bucket << shift;
+}
+
+uint64_t LatencyHistogram::getBucketMax(int bucket)
+{
+  if (bucket < NB_SUB_BUCKETS) return bucket;
+  int shift = bucket / NB_SUB_BUCKETS - 1;
+  uint64_t sub_bucket = bucket % NB_SUB_BUCKETS + NB_SUB_BUCKETS;
+  // All values with the same highest bits
+  return ((sub_bucket + 1) << shift) - 1;
+}
+
+}
@@ -0,0 +1,94 @@
+#include "rosban_utils/mapped_file.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace rosban_utils
+{
+
+MappedFile::MappedFile(const std::string & path, Access access)
+  : data(nullptr), size(0)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::ostringstream oss;
+    oss << "MappedFile: failed to open '" << path << "': " << strerror(errno);
+    throw std::runtime_error(oss.str());
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    std::ostringstream oss;
+    oss << "MappedFile: failed to get size of '" << path << "': " << strerror(errno);
+    close(fd);
+    throw std::runtime_error(oss.str());
+  }
+  size = file_stat.st_size;
+  // Empty files cannot be mapped
+  if (size > 0) {
+    void * address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (address == MAP_FAILED) {
+      std::ostringstream oss;
+      oss << "MappedFile: failed to map '" << path << "': " << strerror(errno);
+      close(fd);
+      throw std::runtime_error(oss.str());
+    }
+    data = static_cast<const char *>(address);
+  }
+  // The mapping stays valid after closing the file descriptor
+  close(fd);
+  advise(0, size, access);
+}
+
+MappedFile::~MappedFile()
+{
+  if (data) {
+    munmap(const_cast<char *>(data), size);
+  }
+}
+
+const char * MappedFile::getData() const
+{
+  return data;
+}
+
+size_t MappedFile::getSize() const
+{
+  return size;
+}
+
+void MappedFile::advise(size_t offset, size_t length, Access access) const
+{
+  if (!data || length == 0) return;
+  if (offset + length > size) {
+    throw std::logic_error("MappedFile::advise: range is outside of the file");
+  }
+  // madvise requires an address aligned on a page
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t aligned_offset = offset - offset % page_size;
+  int advice = access == Access::Sequential ? MADV_SEQUENTIAL : MADV_RANDOM;
+  // Hints are optional, failures are ignored
+  madvise(const_cast<char *>(data + aligned_offset), length + offset - aligned_offset, advice);
+}
+
+void MappedFile::release(size_t offset, size_t length) const
+{
+  if (!data) return;
+  if (offset + length > size) {
+    throw std::logic_error("MappedFile::release: range is outside of the file");
+  }
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t first_page = (offset + page_size - 1) / page_size;
+  size_t last_page = (offset + length) / page_size;
+  if (last_page <= first_page) return;
+  madvise(const_cast<char *>(data + first_page * page_size),
+          (last_page - first_page) * page_size, MADV_DONTNEED);
+}
+
+}
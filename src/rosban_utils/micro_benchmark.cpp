@@ -0,0 +1,232 @@
+#include "rosban_utils/micro_benchmark.h"
+
+#include "rosban_utils/benchmark.h"
+#include "rosban_utils/time_stamp.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+namespace rosban_utils
+{
+
+MicroBenchmark::Config::Config()
+  : warmup_time(0.1), target_time(0.01), nb_repetitions(30), regression_threshold(0.05)
+{
+}
+
+MicroBenchmark::MicroBenchmark(const Config & c)
+  : config(c)
+{
+  if (config.nb_repetitions < 2) {
+    throw std::logic_error("MicroBenchmark: nb_repetitions should be at least 2");
+  }
+  if (config.target_time <= 0) {
+    throw std::logic_error("MicroBenchmark: target_time should be strictly positive");
+  }
+}
+
+const MicroBenchmark::Result & MicroBenchmark::run(const std::string & name, Task task)
+{
+  // Warmup: caches, branch predictors and frequency scaling
+  TimeStamp warmup_start = TimeStamp::now();
+  do {
+    task();
+  } while (diffSec(warmup_start, TimeStamp::now()) < config.warmup_time);
+  // Calibration: increase the number of iterations until target time is reached
+  int nb_iterations = 1;
+  double elapsed = measure(name, task, nb_iterations);
+  while (elapsed < config.target_time) {
+    double factor = 10;
+    if (elapsed > 0) {
+      // Aiming slightly above target, growing at most by a factor 10 per step
+      factor = std::min(factor, 1.2 * config.target_time / elapsed);
+    }
+    nb_iterations = std::max(nb_iterations + 1, (int)std::ceil(nb_iterations * factor));
+    elapsed = measure(name, task, nb_iterations);
+  }
+  // Measures
+  std::vector<double> durations;
+  for (int repetition = 0; repetition < config.nb_repetitions; repetition++) {
+    durations.push_back(measure(name, task, nb_iterations) / nb_iterations);
+  }
+  results.push_back(computeStats(name, nb_iterations, durations));
+  return results.back();
+}
+
+const std::vector<MicroBenchmark::Result> & MicroBenchmark::getResults() const
+{
+  return results;
+}
+
+void MicroBenchmark::print(std::ostream & out) const
+{
+  for (const Result & result : results) {
+    out << result.name << ": " << (result.mean * 1e9) << " ns +- "
+        << ((result.ci_high - result.ci_low) / 2 * 1e9) << " ns (median: "
+        << (result.median * 1e9) << " ns, stddev: " << (result.stddev * 1e9)
+        << " ns, min/max: " << (result.min * 1e9) << "/" << (result.max * 1e9)
+        << " ns, " << result.nb_repetitions << "x" << result.nb_iterations
+        << " iterations)" << std::endl;
+  }
+}
+
+void MicroBenchmark::saveBaseline(const std::string & path) const
+{
+  std::ofstream out(path);
+  if (!out) {
+    throw std::runtime_error("MicroBenchmark::saveBaseline: failed to open file '" + path + "'");
+  }
+  out << std::setprecision(17);
+  // Name is written last since it might contain spaces
+  out << "# nb_iterations nb_repetitions mean median stddev min max ci_low ci_high name" << std::endl;
+  for (const Result & result : results) {
+    out << result.nb_iterations << " " << result.nb_repetitions << " "
+        << result.mean << " " << result.median << " " << result.stddev << " "
+        << result.min << " " << result.max << " "
+        << result.ci_low << " " << result.ci_high << " " << result.name << std::endl;
+  }
+  if (!out) {
+    throw std::runtime_error("MicroBenchmark::saveBaseline: failed to write file '" + path + "'");
+  }
+}
+
+std::vector<MicroBenchmark::Result> MicroBenchmark::loadBaseline(const std::string & path)
+{
+  std::ifstream in(path);
+  if (!in) {
+    throw std::runtime_error("MicroBenchmark::loadBaseline: failed to open file '" + path + "'");
+  }
+  std::vector<Result> baseline;
+  std::string line;
+  int line_number = 0;
+  while (std::getline(in, line)) {
+    line_number++;
+    if (line.empty() || line[0] == '#') continue;
+    std::istringstream line_stream(line);
+    Result result;
+    line_stream >> result.nb_iterations >> result.nb_repetitions
+                >> result.mean >> result.median >> result.stddev
+                >> result.min >> result.max >> result.ci_low >> result.ci_high;
+    line_stream >> std::ws;
+    std::getline(line_stream, result.name);
+    if (!line_stream && !line_stream.eof()) {
+      std::ostringstream oss;
+      oss << "MicroBenchmark::loadBaseline: invalid line " << line_number
+          << " in file '" << path << "'";
+      throw std::runtime_error(oss.str());
+    }
+    baseline.push_back(result);
+  }
+  return baseline;
+}
+
+MicroBenchmark::Status MicroBenchmark::compare(const Result & result,
+                                               const std::vector<Result> & baseline) const
+{
+  for (const Result & reference : baseline) {
+    if (reference.name != result.name) continue;
+    // Both a significant change and non-overlapping intervals are required
+    if (result.mean > reference.mean * (1 + config.regression_threshold) &&
+        result.ci_low > reference.ci_high) {
+      return Status::Regression;
+    }
+    if (result.mean < reference.mean * (1 - config.regression_threshold) &&
+        result.ci_high < reference.ci_low) {
+      return Status::Improvement;
+    }
+    return Status::Unchanged;
+  }
+  return Status::New;
+}
+
+int MicroBenchmark::compareToBaseline(const std::string & path, std::ostream & out) const
+{
+  std::vector<Result> baseline = loadBaseline(path);
+  int nb_regressions = 0;
+  for (const Result & result : results) {
+    Status status = compare(result, baseline);
+    out << result.name << ": " << (result.mean * 1e9) << " ns";
+    if (status == Status::New) {
+      out << " (new)" << std::endl;
+      continue;
+    }
+    for (const Result & reference : baseline) {
+      if (reference.name != result.name) continue;
+      out << " vs " << (reference.mean * 1e9) << " ns ("
+          << std::showpos << ((result.mean / reference.mean - 1) * 100)
+          << std::noshowpos << "%)";
+      break;
+    }
+    switch (status) {
+      case Status::Regression:
+        out << " REGRESSION";
+        nb_regressions++;
+        break;
+      case Status::Improvement:
+        out << " improvement";
+        break;
+      default:
+        break;
+    }
+    out << std::endl;
+  }
+  return nb_regressions;
+}
+
+double MicroBenchmark::measure(const std::string & name, Task & task, int nb_iterations)
+{
+  Benchmark::open(name);
+  for (int iteration = 0; iteration < nb_iterations; iteration++) {
+    task();
+  }
+  return Benchmark::close();
+}
+
+MicroBenchmark::Result MicroBenchmark::computeStats(const std::string & name,
+                                                    int nb_iterations,
+                                                    std::vector<double> durations)
+{
+  int n = durations.size();
+  std::sort(durations.begin(), durations.end());
+  Result result;
+  result.name = name;
+  result.nb_iterations = nb_iterations;
+  result.nb_repetitions = n;
+  result.min = durations.front();
+  result.max = durations.back();
+  result.median = n % 2 == 1 ? durations[n / 2] : (durations[n / 2 - 1] + durations[n / 2]) / 2;
+  double sum = 0;
+  for (double duration : durations) sum += duration;
+  result.mean = sum / n;
+  double squared_deviations = 0;
+  for (double duration : durations) {
+    squared_deviations += (duration - result.mean) * (duration - result.mean);
+  }
+  result.stddev = std::sqrt(squared_deviations / (n - 1));
+  double half_width = getStudentQuantile(n - 1) * result.stddev / std::sqrt(n);
+  result.ci_low = result.mean - half_width;
+  result.ci_high = result.mean + half_width;
+  return result;
+}
+
+double MicroBenchmark::getStudentQuantile(int degrees_of_freedom)
+{
+  // Two-sided 95% quantiles for 1 to 30 degrees of freedom
+  static const double quantiles[30] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+  };
+  if (degrees_of_freedom < 1) {
+    throw std::logic_error("MicroBenchmark::getStudentQuantile: at least 1 degree of freedom required");
+  }
+  if (degrees_of_freedom <= 30) return quantiles[degrees_of_freedom - 1];
+  // Approximation, error below 0.005 for larger values
+  return 1.96 + 2.4 / degrees_of_freedom;
+}
+
+}
@@ -1,10 +1,402 @@
 #include "rosban_utils/multi_core.h"
 
-#include <thread>
+#include "rosban_utils/benchmark.h"
+#include "rosban_utils/time_stamp.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 namespace rosban_utils
 {
 
+MultiCore::Pool::Placement::Placement(Type type_, const std::vector<int> & cores_)
+  : type(type_), cores(cores_)
+{
+}
+
+MultiCore::Pool::Pool(int nb_threads)
+  : run_owner(std::thread::id()), generation(0), active_workers(0), stop(false),
+    job(nullptr), nb_jobs(0), static_assignment(false), next_job(0), nb_done_jobs(0)
+{
+  reserve(nb_threads);
+}
+
+MultiCore::Pool::~Pool()
+{
+  {
+    std::lock_guard<std::mutex> lock(batch_mutex);
+    stop = true;
+  }
+  batch_start.notify_all();
+  for (std::thread & worker : workers) {
+    worker.join();
+  }
+}
+
+void MultiCore::Pool::checkNotRunning(const std::string & method) const
+{
+  if (run_owner.load() == std::this_thread::get_id()) {
+    throw std::logic_error("MultiCore::Pool::" + method + ": cannot be called from a job of the pool");
+  }
+}
+
+int MultiCore::Pool::getNbThreads() const
+{
+  // Calling thread is also used to process jobs
+  return workers.size() + 1;
+}
+
+void MultiCore::Pool::reserve(int nb_threads)
+{
+  checkNotRunning("reserve");
+  std::lock_guard<std::mutex> run_lock(run_mutex);
+  while (getNbThreads() < nb_threads) {
+    addWorker();
+  }
+}
+
+void MultiCore::Pool::setPlacement(const Placement & placement)
+{
+  std::vector<int> new_cores;
+  switch (placement.type) {
+    case Placement::Type::None:
+      break;
+    case Placement::Type::Compact:
+    case Placement::Type::Scatter:
+      new_cores = getAvailableCores(placement.type);
+      break;
+    case Placement::Type::Explicit:
+      if (placement.cores.size() == 0) {
+        throw std::logic_error("MultiCore::Pool::setPlacement: no cores provided");
+      }
+      new_cores = placement.cores;
+      {
+        std::vector<int> available = getAvailableCores(Placement::Type::Compact);
+        for (int core : new_cores) {
+          if (std::find(available.begin(), available.end(), core) == available.end()) {
+            std::ostringstream oss;
+            oss << "MultiCore::Pool::setPlacement: core " << core << " is not available";
+            throw std::logic_error(oss.str());
+          }
+        }
+      }
+      break;
+  }
+  checkNotRunning("setPlacement");
+  std::lock_guard<std::mutex> run_lock(run_mutex);
+  cores = new_cores;
+  for (size_t worker_idx = 0; worker_idx < workers.size(); worker_idx++) {
+    pinWorker(worker_idx);
+  }
+}
+
+const std::vector<int> & MultiCore::Pool::getCores() const
+{
+  return cores;
+}
+
+std::vector<int> MultiCore::Pool::getAvailableCores(Placement::Type type)
+{
+  std::vector<int> result;
+#ifdef __linux__
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) != 0) {
+    throw std::runtime_error("MultiCore::Pool::getAvailableCores: sched_getaffinity failed");
+  }
+  // Group cores by socket
+  std::map<int, std::vector<int>> cores_by_socket;
+  for (int core = 0; core < CPU_SETSIZE; core++) {
+    if (!CPU_ISSET(core, &cpu_set)) continue;
+    std::ostringstream path;
+    path << "/sys/devices/system/cpu/cpu" << core << "/topology/physical_package_id";
+    std::ifstream in(path.str());
+    int socket = 0;
+    if (!(in >> socket)) socket = 0;
+    cores_by_socket[socket].push_back(core);
+  }
+  if (type == Placement::Type::Scatter) {
+    // Round-robin on the sockets
+    for (size_t rank = 0; result.size() < (size_t)CPU_COUNT(&cpu_set); rank++) {
+      for (const auto & entry : cores_by_socket) {
+        if (rank < entry.second.size()) result.push_back(entry.second[rank]);
+      }
+    }
+  }
+  else {
+    for (const auto & entry : cores_by_socket) {
+      result.insert(result.end(), entry.second.begin(), entry.second.end());
+    }
+  }
+#else
+  (void)type;
+  int nb_cores = std::max(1u, std::thread::hardware_concurrency());
+  for (int core = 0; core < nb_cores; core++) {
+    result.push_back(core);
+  }
+#endif
+  return result;
+}
+
+void MultiCore::Pool::run(int nb_jobs_, const Job & job_)
+{
+  if (nb_jobs_ <= 0) return;
+  std::unique_lock<std::mutex> run_lock(run_mutex, std::defer_lock);
+  // A job run by the calling thread might call run again, the mutex is then
+  // already owned by this thread and cannot even be tried
+  if (run_owner.load() != std::this_thread::get_id()) {
+    run_lock.try_lock();
+  }
+  // Specific case for one job, just use current thread unless workers are pinned
+  if (nb_jobs_ == 1 && (!run_lock.owns_lock() || cores.size() == 0)) {
+    if (run_lock.owns_lock()) run_lock.unlock();
+    job_(0);
+    return;
+  }
+  // Pool is already used (nested or concurrent call), avoid waiting for it
+  if (!run_lock.owns_lock()) {
+    runOnNewThreads(nb_jobs_, job_);
+    return;
+  }
+  // Owner is cleared before the mutex is released, even if a job throws
+  struct OwnerReset
+  {
+    std::atomic<std::thread::id> & owner;
+    ~OwnerReset() { owner.store(std::thread::id()); }
+  };
+  run_owner.store(std::this_thread::get_id());
+  OwnerReset owner_reset{run_owner};
+  // With pinned workers, calling thread does not process jobs
+  bool pinned = cores.size() > 0;
+  while (getNbThreads() < nb_jobs_ + (pinned ? 1 : 0)) {
+    addWorker();
+  }
+  {
+    std::unique_lock<std::mutex> lock(batch_mutex);
+    // Workers late from previous batch should not see a partially updated batch
+    batch_end.wait(lock, [this]() { return active_workers == 0; });
+    job = &job_;
+    nb_jobs = nb_jobs_;
+    static_assignment = pinned;
+    next_job = 0;
+    nb_done_jobs = 0;
+    error = nullptr;
+    generation++;
+  }
+  batch_start.notify_all();
+  // Calling thread participates to the batch
+  processJobs(-1);
+  std::exception_ptr batch_error;
+  {
+    std::unique_lock<std::mutex> lock(batch_mutex);
+    batch_end.wait(lock, [this]() { return nb_done_jobs == nb_jobs; });
+    batch_error = error;
+  }
+  if (batch_error) {
+    std::rethrow_exception(batch_error);
+  }
+}
+
+MultiCore::Pool & MultiCore::Pool::getInstance()
+{
+  static Pool instance;
+  return instance;
+}
+
+void MultiCore::Pool::addWorker()
+{
+  int worker_idx = workers.size();
+  // Workers created by run are added before the batch is started, they
+  // should not skip it if their thread starts after it
+  unsigned long start_generation;
+  {
+    std::lock_guard<std::mutex> lock(batch_mutex);
+    start_generation = generation;
+  }
+  workers.push_back(std::thread([this, worker_idx, start_generation]()
+                                {
+                                  workerLoop(worker_idx, start_generation);
+                                }));
+  pinWorker(worker_idx);
+}
+
+void MultiCore::Pool::pinWorker(int worker_idx)
+{
+#ifdef __linux__
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  if (cores.size() > 0) {
+    CPU_SET(cores[worker_idx % cores.size()], &cpu_set);
+  }
+  else {
+    // Unpin: allow all the cores of the process
+    if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) != 0) return;
+  }
+  int err = pthread_setaffinity_np(workers[worker_idx].native_handle(),
+                                   sizeof(cpu_set), &cpu_set);
+  if (err != 0) {
+    std::ostringstream oss;
+    oss << "MultiCore::Pool::pinWorker: failed to pin worker " << worker_idx;
+    if (cores.size() > 0) oss << " on core " << cores[worker_idx % cores.size()];
+    throw std::runtime_error(oss.str());
+  }
+#else
+  (void)worker_idx;
+#endif
+}
+
+void MultiCore::Pool::workerLoop(int worker_idx, unsigned long last_generation)
+{
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(batch_mutex);
+      batch_start.wait(lock, [this, &last_generation]()
+                       { return stop || generation != last_generation; });
+      if (stop) return;
+      last_generation = generation;
+      active_workers++;
+    }
+    processJobs(worker_idx);
+    {
+      std::lock_guard<std::mutex> lock(batch_mutex);
+      active_workers--;
+      if (active_workers == 0) batch_end.notify_all();
+    }
+  }
+}
+
+void MultiCore::Pool::processJobs(int worker_idx)
+{
+  if (static_assignment) {
+    if (worker_idx >= 0 && worker_idx < nb_jobs) processJob(worker_idx);
+    return;
+  }
+  while (true) {
+    int job_idx = next_job.fetch_add(1);
+    if (job_idx >= nb_jobs) return;
+    processJob(job_idx);
+  }
+}
+
+void MultiCore::Pool::processJob(int job_idx)
+{
+  try {
+    (*job)(job_idx);
+  }
+  catch (...) {
+    std::lock_guard<std::mutex> lock(batch_mutex);
+    if (!error) error = std::current_exception();
+  }
+  // Last job notifies the caller
+  if (nb_done_jobs.fetch_add(1) + 1 == nb_jobs) {
+    std::lock_guard<std::mutex> lock(batch_mutex);
+    batch_end.notify_all();
+  }
+}
+
+void MultiCore::Pool::runOnNewThreads(int nb_jobs, const Job & job)
+{
+  std::vector<std::exception_ptr> errors(nb_jobs);
+  auto protected_job = [&job, &errors](int job_idx)
+    {
+      try {
+        job(job_idx);
+      }
+      catch (...) {
+        errors[job_idx] = std::current_exception();
+      }
+    };
+  std::vector<std::thread> threads;
+  // Launch all threads, first job is run by calling thread
+  for (int job_idx = 1; job_idx < nb_jobs; job_idx++) {
+    threads.push_back(std::thread(protected_job, job_idx));
+  }
+  protected_job(0);
+  // Wait for all threads to finish
+  for (std::thread & thread : threads) {
+    thread.join();
+  }
+  for (const std::exception_ptr & e : errors) {
+    if (e) std::rethrow_exception(e);
+  }
+}
+
+MultiCore::CancellationToken::CancellationToken()
+  : cancelled(false), has_deadline(false)
+{
+}
+
+MultiCore::CancellationToken::CancellationToken(const TimeStamp & deadline_)
+  : cancelled(false), has_deadline(true), deadline(deadline_)
+{
+}
+
+void MultiCore::CancellationToken::cancel()
+{
+  cancelled = true;
+}
+
+bool MultiCore::CancellationToken::isCancelled() const
+{
+  if (cancelled) return true;
+  return has_deadline && TimeStamp::now() > deadline;
+}
+
+bool MultiCore::CancellationToken::hasDeadline() const
+{
+  return has_deadline;
+}
+
+const TimeStamp & MultiCore::CancellationToken::getDeadline() const
+{
+  return deadline;
+}
+
+MultiCore::Schedule::Schedule(Type type_, int grain_)
+  : type(type_), grain(grain_)
+{
+}
+
+double MultiCore::RunStats::getImbalance() const
+{
+  if (busy_times.size() == 0) return 1;
+  double max_time = *std::max_element(busy_times.begin(), busy_times.end());
+  double mean_time = std::accumulate(busy_times.begin(), busy_times.end(), 0.0) / busy_times.size();
+  if (mean_time <= 0) return 1;
+  return max_time / mean_time;
+}
+
+double MultiCore::RunStats::getEfficiency() const
+{
+  if (busy_times.size() == 0 || wall_time <= 0) return 1;
+  double total_time = std::accumulate(busy_times.begin(), busy_times.end(), 0.0);
+  return total_time / (wall_time * busy_times.size());
+}
+
+void MultiCore::RunStats::print(std::ostream & out) const
+{
+  out << "wall time: " << (wall_time * 1000) << " ms, imbalance: " << getImbalance()
+      << ", efficiency: " << getEfficiency() << std::endl;
+  for (size_t thread_no = 0; thread_no < busy_times.size(); thread_no++) {
+    out << "\tthread " << thread_no << ": "
+        << (busy_times[thread_no] * 1000) << " ms, "
+        << nb_tasks[thread_no] << " tasks, "
+        << nb_chunks[thread_no] << " chunks, "
+        << nb_steals[thread_no] << " steals" << std::endl;
+  }
+}
+
 MultiCore::Intervals MultiCore::buildIntervals(int nb_tasks, int nb_threads)
 {
   /// Do not create more threads than tasks
@@ -36,56 +428,630 @@ void MultiCore::runParallelTask(Task t,
                                 int nb_tasks,
                                 int nb_threads)
 {
-  // Specific case for one thread, just use current thread
-  if (nb_threads == 1) {
-    t(0,nb_tasks);
-    return;
-  }
-  MultiCore::Intervals intervals = buildIntervals(nb_tasks, nb_threads);
-  std::vector<std::thread> threads;
-  // Launch all threads
-  for (size_t thread_no = 0; thread_no < intervals.size(); thread_no++)
-  {
-    int start = intervals[thread_no].first;
-    int end = intervals[thread_no].second;
-    threads.push_back(std::thread([t, start, end](){t(start,end);}));
-  }
-  // Wait for all threads to finish
-  for (size_t thread_no = 0; thread_no < intervals.size(); thread_no++)
-  {
-    threads[thread_no].join();
+  runParallelTask(t, nb_tasks, nb_threads, Schedule());
+}
+
+void MultiCore::runParallelTask(Task t,
+                                int nb_tasks,
+                                int nb_threads,
+                                const Schedule & schedule,
+                                RunStats * stats)
+{
+  runScheduledTask([&t](int, int start, int end) { t(start, end); },
+                   nb_tasks, nb_threads, schedule, stats);
+}
+
+MultiCore::Completion MultiCore::runCancellableTask(CancellableTask t,
+                                                    int nb_tasks,
+                                                    int nb_threads,
+                                                    const CancellationToken & token,
+                                                    const Schedule & schedule,
+                                                    RunStats * stats)
+{
+  Completion completion;
+  runPartialTask([&t, &token](int, int start, int end) { return t(start, end, token); },
+                 nb_tasks, nb_threads, schedule, stats, &token, &completion.processed);
+  completion.nb_processed = 0;
+  for (const std::pair<int,int> & interval : completion.processed) {
+    completion.nb_processed += interval.second - interval.first;
   }
+  completion.complete = completion.nb_processed == std::max(0, nb_tasks);
+  return completion;
 }
 
 void MultiCore::runParallelStochasticTask(StochasticTask st,
                                           int nb_tasks,
                                           std::vector<std::default_random_engine> * engines)
+{
+  runParallelStochasticTask(st, nb_tasks, engines, Schedule());
+}
+
+void MultiCore::runParallelStochasticTask(StochasticTask st,
+                                          int nb_tasks,
+                                          std::vector<std::default_random_engine> * engines,
+                                          const Schedule & schedule,
+                                          RunStats * stats)
 {
   if (engines == nullptr || engines->size() == 0) {
     throw std::runtime_error("MultiCore::runParallelStochasticTask with no engines");
   }
-  int nb_threads = engines->size();
-  // Specific case for one thread, just use current thread
-  if (nb_threads == 1) {
-    st(0,nb_tasks, &((*engines)[0]));
+  // Each thread uses its own engine, so each engine is only used by one thread at a time
+  runScheduledTask([&st, engines](int thread_no, int start, int end)
+                   {
+                     st(start, end, &((*engines)[thread_no]));
+                   },
+                   nb_tasks, engines->size(), schedule, stats);
+}
+
+void MultiCore::runParallelSeededTask(SeededTask st,
+                                      int nb_tasks,
+                                      int nb_threads,
+                                      unsigned long seed,
+                                      const Schedule & schedule,
+                                      RunStats * stats)
+{
+  runScheduledTask([&st, seed](int, int start, int end)
+                   {
+                     TaskEngine engine;
+                     for (int task_idx = start; task_idx < end; task_idx++) {
+                       engine.seed(getTaskSeed(seed, task_idx));
+                       st(task_idx, &engine);
+                     }
+                   },
+                   nb_tasks, nb_threads, schedule, stats);
+}
+
+void MultiCore::parallelFor(TileTask t,
+                            const std::vector<int> & sizes,
+                            const std::vector<int> & tile_sizes,
+                            int nb_threads,
+                            const Schedule & schedule)
+{
+  if (sizes.size() != tile_sizes.size()) {
+    std::ostringstream oss;
+    oss << "MultiCore::parallelFor: inconsistent dimensions: sizes has " << sizes.size()
+        << " dimensions and tile_sizes has " << tile_sizes.size();
+    throw std::logic_error(oss.str());
+  }
+  // Number of tiles along each dimension, the product is computed on 64 bits
+  // since tiles are indexed by an int
+  std::vector<int> nb_tiles(sizes.size());
+  int64_t total_tiles = sizes.size() > 0 ? 1 : 0;
+  for (size_t dim = 0; dim < sizes.size(); dim++) {
+    if (tile_sizes[dim] < 1) {
+      throw std::logic_error("MultiCore::parallelFor: tile sizes should be strictly positive");
+    }
+    int size = std::max(0, sizes[dim]);
+    nb_tiles[dim] = size / tile_sizes[dim] + (size % tile_sizes[dim] != 0 ? 1 : 0);
+    total_tiles *= nb_tiles[dim];
+    if (total_tiles > std::numeric_limits<int>::max()) {
+      std::ostringstream oss;
+      oss << "MultiCore::parallelFor: too many tiles, more than "
+          << std::numeric_limits<int>::max() << " after dimension " << dim;
+      throw std::logic_error(oss.str());
+    }
+  }
+  runScheduledTask([&t, &sizes, &tile_sizes, &nb_tiles](int, int start, int end)
+                   {
+                     std::vector<int> tile_start(sizes.size()), tile_end(sizes.size());
+                     for (int tile = start; tile < end; tile++) {
+                       // First dimension varies the fastest
+                       int remainder = tile;
+                       for (size_t dim = 0; dim < sizes.size(); dim++) {
+                         int tile_idx = remainder % nb_tiles[dim];
+                         remainder /= nb_tiles[dim];
+                         tile_start[dim] = tile_idx * tile_sizes[dim];
+                         tile_end[dim] = tile_start[dim] + std::min(tile_sizes[dim], sizes[dim] - tile_start[dim]);
+                       }
+                       t(tile_start, tile_end);
+                     }
+                   },
+                   (int)total_tiles, nb_threads, schedule, nullptr);
+}
+
+std::vector<int> MultiCore::buildTileSizes(const std::vector<int> & sizes,
+                                           int max_tile_elements)
+{
+  std::vector<int> tile_sizes(sizes.size(), 1);
+  int remaining = std::max(1, max_tile_elements);
+  for (size_t dim = 0; dim < sizes.size(); dim++) {
+    tile_sizes[dim] = std::max(1, std::min(sizes[dim], remaining));
+    remaining /= tile_sizes[dim];
+  }
+  return tile_sizes;
+}
+
+uint64_t MultiCore::getTaskSeed(unsigned long seed, int task_idx)
+{
+  // splitmix64 finalizer applied to the combination of seed and index
+  uint64_t z = (uint64_t)seed + ((uint64_t)task_idx + 1) * 0x9E3779B97F4A7C15ULL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+namespace
+{
+
+/// Load of a single thread during a run
+struct ThreadLoad
+{
+  ThreadLoad() : busy_time(0), nb_tasks(0), nb_chunks(0), nb_steals(0) {}
+  double busy_time;
+  int nb_tasks;
+  int nb_chunks;
+  int nb_steals;
+};
+
+/// Tasks which have not been processed yet by a thread. Padded to avoid
+/// false sharing between neighbours
+struct StealableRange
+{
+  std::mutex mutex;
+  int start;
+  int end;
+  char padding[64];
+};
+
+/// Steal the upper half of the remaining tasks of another thread and store them
+/// in the range of 'thread_no'. Return false if there was nothing to steal
+bool steal(std::vector<StealableRange> & ranges, int thread_no)
+{
+  int nb_threads = ranges.size();
+  for (int offset = 1; offset < nb_threads; offset++) {
+    StealableRange & victim = ranges[(thread_no + offset) % nb_threads];
+    int start, end;
+    {
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      int remaining = victim.end - victim.start;
+      if (remaining <= 0) continue;
+      start = victim.start + remaining / 2;
+      end = victim.end;
+      victim.end = start;
+    }
+    StealableRange & own = ranges[thread_no];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    own.start = start;
+    own.end = end;
+    return true;
+  }
+  return false;
+}
+
+}
+
+void MultiCore::runScheduledTask(ThreadTask t,
+                                 int nb_tasks,
+                                 int nb_threads,
+                                 const Schedule & schedule,
+                                 RunStats * stats)
+{
+  runPartialTask([&t](int thread_no, int start, int end)
+                 {
+                   t(thread_no, start, end);
+                   return end;
+                 },
+                 nb_tasks, nb_threads, schedule, stats, nullptr, nullptr);
+}
+
+void MultiCore::runPartialTask(PartialThreadTask t,
+                               int nb_tasks,
+                               int nb_threads,
+                               const Schedule & schedule,
+                               RunStats * stats,
+                               const CancellationToken * token,
+                               Intervals * processed)
+{
+  if (nb_threads < 1) {
+    throw std::logic_error("MultiCore::runPartialTask: nb_threads should be strictly positive");
+  }
+  if (schedule.type != Schedule::Type::Static && schedule.grain < 1) {
+    throw std::logic_error("MultiCore::runPartialTask: grain should be strictly positive");
+  }
+  nb_threads = std::max(1, std::min(nb_tasks, nb_threads));
+  std::vector<ThreadLoad> loads(nb_threads);
+  std::vector<Intervals> processed_by_thread(nb_threads);
+  TimeStamp run_start = TimeStamp::now();
+  // Process a chunk of tasks, return false if the run has been cancelled or if
+  // the task stopped before the end of the chunk
+  auto run_chunk = [&t, &loads, &processed_by_thread, token, processed]
+    (int thread_no, int start, int end) -> bool
+    {
+      if (token != nullptr && token->isCancelled()) return false;
+      int reached = t(thread_no, start, end);
+      if (reached < start || reached > end) {
+        std::ostringstream oss;
+        oss << "MultiCore::runPartialTask: task on [" << start << "," << end
+            << "[ returned " << reached;
+        throw std::logic_error(oss.str());
+      }
+      loads[thread_no].nb_tasks += reached - start;
+      loads[thread_no].nb_chunks++;
+      if (processed != nullptr && reached > start) {
+        processed_by_thread[thread_no].push_back(std::pair<int,int>(start, reached));
+      }
+      return reached == end;
+    };
+  if (nb_tasks > 0) {
+    int grain = schedule.grain;
+    Intervals intervals;
+    std::atomic<int> next_task(0);
+    std::vector<StealableRange> ranges;
+    Pool::Job job;
+    switch (schedule.type) {
+      case Schedule::Type::Static:
+        intervals = buildIntervals(nb_tasks, nb_threads);
+        job = [&run_chunk, &intervals](int thread_no)
+          {
+            run_chunk(thread_no, intervals[thread_no].first, intervals[thread_no].second);
+          };
+        break;
+      case Schedule::Type::Dynamic:
+        job = [&run_chunk, &next_task, grain, nb_tasks](int thread_no)
+          {
+            while (true) {
+              int start = next_task.fetch_add(grain);
+              if (start >= nb_tasks) return;
+              int end = std::min(start + grain, nb_tasks);
+              if (!run_chunk(thread_no, start, end)) return;
+            }
+          };
+        break;
+      case Schedule::Type::WorkStealing:
+        intervals = buildIntervals(nb_tasks, nb_threads);
+        ranges = std::vector<StealableRange>(nb_threads);
+        for (int thread_no = 0; thread_no < nb_threads; thread_no++) {
+          ranges[thread_no].start = intervals[thread_no].first;
+          ranges[thread_no].end = intervals[thread_no].second;
+        }
+        job = [&run_chunk, &ranges, &loads, grain](int thread_no)
+          {
+            StealableRange & own = ranges[thread_no];
+            while (true) {
+              int start, end;
+              {
+                std::lock_guard<std::mutex> lock(own.mutex);
+                start = own.start;
+                end = std::min(start + grain, own.end);
+                own.start = std::max(start, end);
+              }
+              if (start < end) {
+                if (!run_chunk(thread_no, start, end)) return;
+              }
+              else if (steal(ranges, thread_no)) {
+                loads[thread_no].nb_steals++;
+              }
+              else {
+                return;
+              }
+            }
+          };
+        break;
+    }
+    // Zones opened by the tasks are merged into the zone surrounding the call
+    std::shared_ptr<Benchmark::WorkerGroup> worker_group = Benchmark::getWorkerGroup();
+    Pool::Job attached_job = [&job, &worker_group](int thread_no)
+      {
+        Benchmark::Attachment attachment(worker_group);
+        job(thread_no);
+      };
+    if (stats != nullptr) {
+      // Measuring busy time is only done when required
+      Pool::Job measured_job = [&attached_job, &loads](int thread_no)
+        {
+          TimeStamp start = TimeStamp::now();
+          attached_job(thread_no);
+          loads[thread_no].busy_time = diffSec(start, TimeStamp::now());
+        };
+      Pool::getInstance().run(nb_threads, measured_job);
+    }
+    else {
+      Pool::getInstance().run(nb_threads, attached_job);
+    }
+  }
+  if (stats != nullptr) {
+    stats->wall_time = diffSec(run_start, TimeStamp::now());
+    stats->busy_times.clear();
+    stats->nb_tasks.clear();
+    stats->nb_chunks.clear();
+    stats->nb_steals.clear();
+    for (const ThreadLoad & load : loads) {
+      stats->busy_times.push_back(load.busy_time);
+      stats->nb_tasks.push_back(load.nb_tasks);
+      stats->nb_chunks.push_back(load.nb_chunks);
+      stats->nb_steals.push_back(load.nb_steals);
+    }
+  }
+  if (processed != nullptr) {
+    // Gather processed chunks and merge contiguous ones
+    Intervals chunks;
+    for (const Intervals & thread_chunks : processed_by_thread) {
+      chunks.insert(chunks.end(), thread_chunks.begin(), thread_chunks.end());
+    }
+    std::sort(chunks.begin(), chunks.end());
+    processed->clear();
+    for (const std::pair<int,int> & chunk : chunks) {
+      if (processed->size() > 0 && processed->back().second == chunk.first) {
+        processed->back().second = chunk.second;
+      }
+      else {
+        processed->push_back(chunk);
+      }
+    }
+  }
+}
+
+class MultiCore::AsyncNode
+{
+public:
+  AsyncNode(ThreadTask task_, const Intervals & intervals_)
+    : task(task_), intervals(intervals_), remaining_jobs(intervals_.size()),
+      remaining_dependencies(1), finished(false), future(promise.get_future().share())
+    {
+    }
+
+  /// Run the given job and finish the node if it was the last one
+  static void runJob(const std::shared_ptr<AsyncNode> & node, int job_idx);
+
+  /// Push the jobs to the workers, or finish the node directly if there is
+  /// nothing to run (no tasks or failed dependency)
+  static void start(const std::shared_ptr<AsyncNode> & node);
+
+  /// Mark the node as finished and start dependents which are ready
+  static void finish(const std::shared_ptr<AsyncNode> & node);
+
+  /// Decrease the number of remaining dependencies and start the node if
+  /// there is none left. 'dependency_error' is the error of the dependency
+  static void releaseDependency(const std::shared_ptr<AsyncNode> & node,
+                                std::exception_ptr dependency_error);
+
+  ThreadTask task;
+  Intervals intervals;
+  std::atomic<int> remaining_jobs;
+
+  /// Protects the members below
+  std::mutex mutex;
+  int remaining_dependencies;
+  bool finished;
+  /// First exception raised by the task or by one of its dependencies
+  std::exception_ptr error;
+  std::vector<std::shared_ptr<AsyncNode>> dependents;
+
+  std::promise<void> promise;
+  std::shared_future<void> future;
+};
+
+namespace
+{
+
+/// Workers shared by all the asynchronous tasks, jobs are processed in the
+/// order they were pushed
+class AsyncExecutor
+{
+public:
+  typedef std::pair<std::shared_ptr<MultiCore::AsyncNode>, int> Job;
+
+  AsyncExecutor() : stop(false) {}
+
+  ~AsyncExecutor()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+      }
+      job_available.notify_all();
+      for (std::thread & worker : workers) {
+        worker.join();
+      }
+    }
+
+  /// Ensure that at least 'nb_threads' jobs can be processed in parallel
+  void reserve(int nb_threads)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      while ((int)workers.size() < nb_threads) {
+        workers.push_back(std::thread([this]() { workerLoop(); }));
+      }
+    }
+
+  void push(const std::vector<Job> & jobs)
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.insert(queue.end(), jobs.begin(), jobs.end());
+      }
+      job_available.notify_all();
+    }
+
+  static AsyncExecutor & getInstance()
+    {
+      static AsyncExecutor instance;
+      return instance;
+    }
+
+private:
+  void workerLoop()
+    {
+      while (true) {
+        Job job;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          job_available.wait(lock, [this]() { return stop || queue.size() > 0; });
+          if (stop) return;
+          job = queue.front();
+          queue.pop_front();
+        }
+        MultiCore::AsyncNode::runJob(job.first, job.second);
+      }
+    }
+
+  std::mutex mutex;
+  std::condition_variable job_available;
+  std::deque<Job> queue;
+  std::vector<std::thread> workers;
+  bool stop;
+};
+
+}
+
+void MultiCore::AsyncNode::runJob(const std::shared_ptr<AsyncNode> & node, int job_idx)
+{
+  try {
+    const std::pair<int,int> & interval = node->intervals[job_idx];
+    node->task(job_idx, interval.first, interval.second);
+  }
+  catch (...) {
+    std::lock_guard<std::mutex> lock(node->mutex);
+    if (!node->error) node->error = std::current_exception();
+  }
+  if (node->remaining_jobs.fetch_sub(1) == 1) {
+    finish(node);
+  }
+}
+
+void MultiCore::AsyncNode::start(const std::shared_ptr<AsyncNode> & node)
+{
+  bool failed;
+  {
+    std::lock_guard<std::mutex> lock(node->mutex);
+    failed = (bool)node->error;
+  }
+  if (failed || node->intervals.size() == 0) {
+    finish(node);
     return;
   }
-  MultiCore::Intervals intervals = buildIntervals(nb_tasks, nb_threads);
-  std::vector<std::thread> threads;
-  // Launch all threads
-  for (size_t thread_no = 0; thread_no < intervals.size(); thread_no++)
+  std::vector<AsyncExecutor::Job> jobs;
+  for (size_t job_idx = 0; job_idx < node->intervals.size(); job_idx++) {
+    jobs.push_back(AsyncExecutor::Job(node, job_idx));
+  }
+  AsyncExecutor::getInstance().push(jobs);
+}
+
+void MultiCore::AsyncNode::finish(const std::shared_ptr<AsyncNode> & node)
+{
+  std::vector<std::shared_ptr<AsyncNode>> to_release;
+  std::exception_ptr node_error;
   {
-    int start = intervals[thread_no].first;
-    int end = intervals[thread_no].second;
-    std::default_random_engine * thread_engine = &((*engines)[thread_no]);
-    threads.push_back(std::thread([st, start, end, thread_engine]()
-                                  {st(start, end, thread_engine);}));
+    std::lock_guard<std::mutex> lock(node->mutex);
+    node->finished = true;
+    node_error = node->error;
+    to_release.swap(node->dependents);
   }
-  // Wait for all threads to finish
-  for (size_t thread_no = 0; thread_no < intervals.size(); thread_no++)
+  if (node_error) {
+    node->promise.set_exception(node_error);
+  }
+  else {
+    node->promise.set_value();
+  }
+  for (const std::shared_ptr<AsyncNode> & dependent : to_release) {
+    releaseDependency(dependent, node_error);
+  }
+}
+
+void MultiCore::AsyncNode::releaseDependency(const std::shared_ptr<AsyncNode> & node,
+                                             std::exception_ptr dependency_error)
+{
+  bool ready;
   {
-    threads[thread_no].join();
+    std::lock_guard<std::mutex> lock(node->mutex);
+    if (dependency_error && !node->error) node->error = dependency_error;
+    node->remaining_dependencies--;
+    ready = node->remaining_dependencies == 0;
+  }
+  if (ready) start(node);
+}
+
+MultiCore::AsyncHandle::AsyncHandle()
+{
+}
+
+MultiCore::AsyncHandle::AsyncHandle(std::shared_ptr<AsyncNode> node_)
+  : node(node_)
+{
+}
+
+bool MultiCore::AsyncHandle::isValid() const
+{
+  return (bool)node;
+}
+
+bool MultiCore::AsyncHandle::isReady() const
+{
+  if (!node) throw std::logic_error("MultiCore::AsyncHandle::isReady: invalid handle");
+  return node->future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+void MultiCore::AsyncHandle::wait() const
+{
+  if (!node) throw std::logic_error("MultiCore::AsyncHandle::wait: invalid handle");
+  node->future.get();
+}
+
+std::shared_future<void> MultiCore::AsyncHandle::getFuture() const
+{
+  if (!node) throw std::logic_error("MultiCore::AsyncHandle::getFuture: invalid handle");
+  return node->future;
+}
+
+MultiCore::AsyncHandle MultiCore::runAsyncTask(Task t,
+                                               int nb_tasks,
+                                               int nb_threads,
+                                               const std::vector<AsyncHandle> & dependencies)
+{
+  return submitAsyncTask([t](int, int start, int end) { t(start, end); },
+                         nb_tasks, nb_threads, dependencies);
+}
+
+MultiCore::AsyncHandle
+MultiCore::runAsyncStochasticTask(StochasticTask st,
+                                  int nb_tasks,
+                                  std::vector<std::default_random_engine> * engines,
+                                  const std::vector<AsyncHandle> & dependencies)
+{
+  if (engines == nullptr || engines->size() == 0) {
+    throw std::runtime_error("MultiCore::runAsyncStochasticTask with no engines");
+  }
+  return submitAsyncTask([st, engines](int thread_no, int start, int end)
+                         {
+                           st(start, end, &((*engines)[thread_no]));
+                         },
+                         nb_tasks, engines->size(), dependencies);
+}
+
+MultiCore::AsyncHandle MultiCore::submitAsyncTask(ThreadTask t,
+                                                  int nb_tasks,
+                                                  int nb_threads,
+                                                  const std::vector<AsyncHandle> & dependencies)
+{
+  if (nb_threads < 1) {
+    throw std::logic_error("MultiCore::submitAsyncTask: nb_threads should be strictly positive");
+  }
+  Intervals intervals;
+  if (nb_tasks > 0) intervals = buildIntervals(nb_tasks, nb_threads);
+  std::shared_ptr<AsyncNode> node(new AsyncNode(t, intervals));
+  AsyncExecutor::getInstance().reserve(intervals.size());
+  // Register node as a dependent of all unfinished dependencies
+  for (const AsyncHandle & dependency : dependencies) {
+    if (!dependency.isValid()) {
+      throw std::logic_error("MultiCore::submitAsyncTask: invalid dependency");
+    }
+    AsyncNode & dep_node = *(dependency.node);
+    std::lock_guard<std::mutex> dep_lock(dep_node.mutex);
+    if (dep_node.finished) {
+      if (dep_node.error) {
+        std::lock_guard<std::mutex> lock(node->mutex);
+        if (!node->error) node->error = dep_node.error;
+      }
+    }
+    else {
+      dep_node.dependents.push_back(node);
+      std::lock_guard<std::mutex> lock(node->mutex);
+      node->remaining_dependencies++;
+    }
   }
+  // Remove the initial dependency which prevented from starting during registration
+  AsyncNode::releaseDependency(node, std::exception_ptr());
+  return AsyncHandle(node);
 }
 
 }
@@ -0,0 +1,163 @@
+#include "rosban_utils/perf_counters.h"
+
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace rosban_utils
+{
+
+#ifdef __linux__
+namespace
+{
+
+/// Open a counter for the calling thread, return -1 on failure
+int openCounter(uint32_t type, uint64_t config, int group_fd)
+{
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.read_format = PERF_FORMAT_GROUP |
+    PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  attr.exclude_hv = 1;
+  // Only the leader is disabled at start, the whole group is enabled with it
+  attr.disabled = group_fd == -1 ? 1 : 0;
+  // Context switches happen in the kernel, they are only counted if kernel is
+  // not excluded. If this is not permitted, the counter is unavailable since
+  // it would always be 0 in user-space
+  attr.exclude_kernel = type == PERF_TYPE_HARDWARE ? 1 : 0;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+}
+#endif
+
+PerfCounters::PerfCounters()
+  : leader_fd(-1), nb_opened(0), has_error(false)
+{
+  fds.fill(-1);
+  positions.fill(-1);
+#ifdef __linux__
+  const uint32_t types[NbCounters] = {
+    PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+    PERF_TYPE_SOFTWARE
+  };
+  const uint64_t configs[NbCounters] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_SW_CONTEXT_SWITCHES
+  };
+  for (int counter = 0; counter < NbCounters; counter++) {
+    int fd = openCounter(types[counter], configs[counter], leader_fd);
+    if (fd < 0) continue;
+    if (leader_fd == -1) leader_fd = fd;
+    fds[counter] = fd;
+    positions[counter] = nb_opened++;
+  }
+  if (leader_fd != -1) {
+    ioctl(leader_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+#endif
+}
+
+PerfCounters::~PerfCounters()
+{
+#ifdef __linux__
+  for (int fd : fds) {
+    if (fd >= 0) close(fd);
+  }
+#endif
+}
+
+bool PerfCounters::isAvailable(Counter counter) const
+{
+  return positions[counter] >= 0;
+}
+
+bool PerfCounters::hasHardwareCounters() const
+{
+  return isAvailable(Cycles) || isAvailable(Instructions) ||
+    isAvailable(CacheMisses) || isAvailable(BranchMisses);
+}
+
+unsigned int PerfCounters::getAvailabilityMask() const
+{
+  unsigned int mask = 0;
+  for (int counter = 0; counter < NbCounters; counter++) {
+    if (positions[counter] >= 0) mask |= 1u << counter;
+  }
+  return mask;
+}
+
+bool PerfCounters::read(Reading & reading) const noexcept
+{
+  reading.values.fill(0);
+  reading.time_enabled = 0;
+  reading.time_running = 0;
+#ifdef __linux__
+  if (leader_fd == -1) return true;
+  // Format: number of counters, time enabled, time running, values
+  uint64_t buffer[NbCounters + 3];
+  ssize_t expected_size = (nb_opened + 3) * sizeof(uint64_t);
+  ssize_t size = ::read(leader_fd, buffer, sizeof(buffer));
+  if (size != expected_size || buffer[0] != (uint64_t)nb_opened) {
+    has_error = true;
+    return false;
+  }
+  reading.time_enabled = buffer[1];
+  reading.time_running = buffer[2];
+  for (int counter = 0; counter < NbCounters; counter++) {
+    if (positions[counter] >= 0) {
+      reading.values[counter] = buffer[positions[counter] + 3];
+    }
+  }
+#endif
+  return true;
+}
+
+bool PerfCounters::hasError() const
+{
+  return has_error;
+}
+
+bool PerfCounters::getDifference(const Reading & start, const Reading & end, Values & difference)
+{
+  uint64_t enabled = end.time_enabled - start.time_enabled;
+  uint64_t running = end.time_running - start.time_running;
+  for (int counter = 0; counter < NbCounters; counter++) {
+    difference[counter] = end.values[counter] - start.values[counter];
+  }
+  if (running == enabled) return false;
+  for (int counter = 0; counter < NbCounters; counter++) {
+    difference[counter] = running == 0 ? 0 :
+      (uint64_t)std::llround(double(difference[counter]) * enabled / running);
+  }
+  return true;
+}
+
+std::string PerfCounters::getName(Counter counter)
+{
+  switch (counter) {
+    case Cycles: return "cycles";
+    case Instructions: return "instructions";
+    case CacheMisses: return "cache-misses";
+    case BranchMisses: return "branch-misses";
+    case ContextSwitches: return "context-switches";
+    case NbCounters: break;
+  }
+  std::ostringstream oss;
+  oss << "PerfCounters::getName: unknown counter " << (int)counter;
+  throw std::logic_error(oss.str());
+}
+
+}
@@ -1,5 +1,11 @@
 #include "rosban_utils/space_tools.h"
 
+#include "rosban_utils/multi_core.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
 namespace rosban_utils
 {
 
@@ -48,4 +54,58 @@ Eigen::MatrixXd discretizeSpace(const Eigen::MatrixXd & limits,
   return points;
 }
 
+void parallelForGrid(const Eigen::MatrixXd & grid,
+                     const std::vector<int> & samples_by_dim,
+                     GridFunction f,
+                     int nb_threads,
+                     int tile_bytes)
+{
+  // Checking consistency
+  int total_points = 1;
+  for (int samples : samples_by_dim) {
+    total_points *= samples;
+  }
+  if (grid.rows() != (int)samples_by_dim.size() || grid.cols() != total_points) {
+    std::ostringstream oss;
+    oss << "parallelForGrid: inconsistency: grid is " << grid.rows() << "x" << grid.cols()
+        << " while samples_by_dim describe " << samples_by_dim.size() << " dimensions and "
+        << total_points << " points";
+    throw std::runtime_error(oss.str());
+  }
+  // Offset between two consecutive points along each dimension
+  std::vector<int> strides(samples_by_dim.size());
+  int stride = 1;
+  for (size_t dim = 0; dim < samples_by_dim.size(); dim++) {
+    strides[dim] = stride;
+    stride *= samples_by_dim[dim];
+  }
+  int point_bytes = std::max(1, (int)(grid.rows() * sizeof(double)));
+  std::vector<int> tile_sizes = MultiCore::buildTileSizes(samples_by_dim,
+                                                          tile_bytes / point_bytes);
+  MultiCore::TileTask tile_task =
+    [&grid, &f, &strides](const std::vector<int> & start, const std::vector<int> & end)
+    {
+      int nb_dims = start.size();
+      for (int dim = 0; dim < nb_dims; dim++) {
+        if (start[dim] >= end[dim]) return;
+      }
+      // Iterating over the points of the tile, first dimension varies the fastest
+      std::vector<int> indices = start;
+      while (true) {
+        int point_idx = 0;
+        for (int dim = 0; dim < nb_dims; dim++) {
+          point_idx += indices[dim] * strides[dim];
+        }
+        f(point_idx, grid.col(point_idx));
+        int dim = 0;
+        while (dim < nb_dims && ++indices[dim] == end[dim]) {
+          indices[dim] = start[dim];
+          dim++;
+        }
+        if (dim == nb_dims) return;
+      }
+    };
+  MultiCore::parallelFor(tile_task, samples_by_dim, tile_sizes, nb_threads);
+}
+
 }
@@ -1,8 +1,10 @@
 #include "rosban_utils/stream_serializable.h"
 
 #include "rosban_utils/io_tools.h"
+#include "rosban_utils/mapped_file.h"
 
 #include <fstream>
+#include <memory>
 #include <ostream>
 #include <sstream>
 #include <stdexcept>
@@ -18,32 +20,120 @@ int StreamSerializable::write(std::ostream & out) const
   return bytes_written;
 }
 
+int StreamSerializable::write(BinaryWriter & out) const
+{
+  int bytes_written = 0;
+  bytes_written += rosban_utils::write<int>(out, getClassID());
+  bytes_written += writeInternal(out);
+  return bytes_written;
+}
+
+int StreamSerializable::writeInternal(BinaryWriter & out) const
+{
+  BinaryWriterBuffer buffer(out);
+  std::ostream stream(&buffer);
+  // Errors of the writer (e.g. lack of space in external memory) are caught
+  // by the stream, they are rethrown instead of only setting badbit
+  stream.exceptions(std::ios::badbit);
+  int bytes_written = writeInternal(stream);
+  if (!stream) {
+    throw std::runtime_error("StreamSerializable::writeInternal: failed to write to BinaryWriter");
+  }
+  return bytes_written;
+}
+
+int StreamSerializable::getSerializedSize() const
+{
+  CountingBuffer buffer;
+  std::ostream stream(&buffer);
+  stream.exceptions(std::ios::badbit);
+  writeInternal(stream);
+  if (!stream) {
+    throw std::runtime_error("StreamSerializable::getSerializedSize: failed to write to counter");
+  }
+  return buffer.getCount();
+}
+
+int StreamSerializable::writeTo(char * buffer, size_t size) const
+{
+  BinaryWriter writer(buffer, size);
+  return write(writer);
+}
+
+int StreamSerializable::read(BinaryReader & in)
+{
+  BinaryReaderBuffer buffer(in);
+  std::istream stream(&buffer);
+  // Errors of the reader (e.g. corrupted compressed data) are rethrown
+  // instead of only setting badbit, which most read methods ignore
+  stream.exceptions(std::ios::badbit);
+  return read(stream);
+}
+
 int StreamSerializable::save(const std::string & filename, bool write_class_id) const
 {
-  std::ofstream out(filename, std::ios::binary);
-  if (!out) {
+  return save(filename, Compression::None, write_class_id);
+}
+
+int StreamSerializable::save(const std::string & filename, Compression compression,
+                             bool write_class_id) const
+{
+  std::ofstream file(filename, std::ios::binary);
+  if (!file) {
     std::ostringstream oss;
     oss << "Failed to open '" << filename << "' for binary writing";
     throw std::runtime_error(oss.str());
   }
+  std::unique_ptr<LZOutputBuffer> compression_buffer;
+  std::unique_ptr<std::ostream> compressed_stream;
+  std::ostream * out = &file;
+  if (compression == Compression::LZ) {
+    compression_buffer.reset(new LZOutputBuffer(file));
+    compressed_stream.reset(new std::ostream(compression_buffer.get()));
+    out = compressed_stream.get();
+  }
   int bytes_written;
-  if (write_class_id)
-    bytes_written = write(out);
-  else
-    bytes_written = writeInternal(out);
-  out.close();
+  {
+    BinaryWriter writer(*out);
+    if (write_class_id)
+      bytes_written = write(writer);
+    else
+      bytes_written = writeInternal(writer);
+    writer.flush();
+  }
+  if (compression_buffer) compression_buffer->close();
+  file.close();
+  if (!file) {
+    std::ostringstream oss;
+    oss << "Failed to write '" << filename << "'";
+    throw std::runtime_error(oss.str());
+  }
   return bytes_written;
 }
 
 void StreamSerializable::load(const std::string & path)
 {
-  std::ifstream in(path, std::ios::binary);
-  if (!in) {
+  std::shared_ptr<MappedFile> file;
+  try {
+    file.reset(new MappedFile(path));
+  }
+  catch (const std::runtime_error & exc) {
     std::ostringstream oss;
-    oss << "Failed to open '" << path << "' for binary writing";
+    oss << "Failed to open '" << path << "' for binary reading: " << exc.what();
     throw std::runtime_error(oss.str());
   }
-  read(in);
+  // Reading directly from the mapped file, without copy through a stream
+  BinaryReader reader(file);
+  if (isLZCompressed(file->getData(), file->getSize())) {
+    LZInputBuffer buffer(reader);
+    std::istream stream(&buffer);
+    // Decompression errors are rethrown to the reader
+    stream.exceptions(std::ios::badbit);
+    BinaryReader decompressed(stream);
+    read(decompressed);
+    return;
+  }
+  read(reader);
 }
 
 }
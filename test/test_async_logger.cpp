@@ -0,0 +1,258 @@
+#include "rosban_utils/async_logger.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace rosban_utils;
+
+namespace
+{
+
+/// Record identified by the thread which logged it and its rank among the
+/// records of this thread
+class LogRecord : public StreamSerializable
+{
+public:
+  LogRecord(int producer_ = 0, int rank_ = 0) : producer(producer_), rank(rank_) {}
+
+  int getClassID() const override { return 7; }
+
+  using StreamSerializable::writeInternal;
+  using StreamSerializable::read;
+
+  int writeInternal(std::ostream & out) const override
+  {
+    return rosban_utils::write<int>(out, producer) + rosban_utils::write<int>(out, rank);
+  }
+
+  int read(std::istream & in) override
+  {
+    return rosban_utils::read<int>(in, &producer) + rosban_utils::read<int>(in, &rank);
+  }
+
+  int producer;
+  int rank;
+};
+
+/// Size of a logged record, class ID included
+const size_t record_size = 3 * sizeof(int);
+
+/// Records contained in the logged data
+std::vector<LogRecord> parseRecords(const std::string & data)
+{
+  if (data.size() % record_size != 0) {
+    throw std::runtime_error("parseRecords: truncated record");
+  }
+  std::vector<LogRecord> records;
+  BinaryReader reader(data.data(), data.size());
+  while (!reader.isEnd()) {
+    int class_id = reader.read<int>();
+    if (class_id != 7) throw std::runtime_error("parseRecords: invalid class ID");
+    LogRecord record;
+    record.read(reader);
+    records.push_back(record);
+  }
+  return records;
+}
+
+std::string readFile(const std::string & path)
+{
+  std::ifstream in(path, std::ios::binary);
+  std::ostringstream oss;
+  oss << in.rdbuf();
+  return oss.str();
+}
+
+/// A named pipe which is not read until 'startReading' is called, thus the
+/// background thread of a logger writing to it blocks once the pipe is full
+class StalledPipe
+{
+public:
+  StalledPipe(const std::string & path_) : path(path_)
+  {
+    std::remove(path.c_str());
+    if (mkfifo(path.c_str(), 0600) != 0) throw std::runtime_error("StalledPipe: mkfifo failed");
+    // Opened first so that the logger can open it for writing without waiting
+    fd = open(path.c_str(), O_RDONLY | O_NONBLOCK);
+    if (fd < 0) throw std::runtime_error("StalledPipe: open failed");
+  }
+
+  ~StalledPipe()
+  {
+    if (reader.joinable()) reader.join();
+    close(fd);
+    std::remove(path.c_str());
+  }
+
+  /// Read the pipe in a background thread until the writer closes it
+  void startReading()
+  {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    reader = std::thread([this]()
+                         {
+                           char buffer[4096];
+                           ssize_t nb_bytes;
+                           while ((nb_bytes = ::read(fd, buffer, sizeof(buffer))) > 0) {
+                             data.append(buffer, nb_bytes);
+                           }
+                         });
+  }
+
+  /// Content read, available once the reading thread is joined
+  const std::string & getData()
+  {
+    reader.join();
+    return data;
+  }
+
+  std::string path;
+
+private:
+  int fd;
+  std::thread reader;
+  std::string data;
+};
+
+}
+
+TEST(AsyncLogger, recordsOfSeveralProducersRoundTrip)
+{
+  std::string path = testing::TempDir() + "async_producers.bin";
+  AsyncLogger::Config config;
+  config.buffer_size = 1024;
+  config.nb_buffers = 4;
+  config.policy = AsyncLogger::OverflowPolicy::Block;
+  AsyncLogger logger(path, config);
+  const int nb_producers = 4;
+  const int nb_records = 5000;
+  // Calls to the logger are serialized by the producers
+  std::mutex logger_mutex;
+  std::vector<std::thread> producers;
+  for (int producer = 0; producer < nb_producers; producer++) {
+    producers.push_back(std::thread([&logger, &logger_mutex, producer]()
+                                    {
+                                      for (int rank = 0; rank < nb_records; rank++) {
+                                        std::lock_guard<std::mutex> lock(logger_mutex);
+                                        logger.log(LogRecord(producer, rank));
+                                      }
+                                    }));
+  }
+  for (std::thread & producer : producers) {
+    producer.join();
+  }
+  logger.close();
+  AsyncLogger::Stats stats = logger.getStats();
+  EXPECT_EQ(uint64_t(nb_producers * nb_records), stats.nb_records);
+  EXPECT_EQ(0u, stats.nb_drops);
+  EXPECT_EQ(stats.nb_bytes_logged, stats.nb_bytes_written);
+  std::vector<LogRecord> records = parseRecords(readFile(path));
+  ASSERT_EQ(size_t(nb_producers * nb_records), records.size());
+  // Records of each producer are in order
+  std::vector<int> next_ranks(nb_producers, 0);
+  for (const LogRecord & record : records) {
+    ASSERT_GE(record.producer, 0);
+    ASSERT_LT(record.producer, nb_producers);
+    ASSERT_EQ(next_ranks[record.producer], record.rank);
+    next_ranks[record.producer]++;
+  }
+  std::remove(path.c_str());
+}
+
+TEST(AsyncLogger, fullRingDropsRecords)
+{
+  StalledPipe pipe(testing::TempDir() + "async_drop.fifo");
+  AsyncLogger::Config config;
+  config.buffer_size = 1024;
+  config.nb_buffers = 2;
+  config.policy = AsyncLogger::OverflowPolicy::Drop;
+  AsyncLogger logger(pipe.path, config);
+  // Much more than the capacity of the pipe and of the ring
+  const int nb_records = 100000;
+  int nb_accepted = 0;
+  for (int rank = 0; rank < nb_records; rank++) {
+    if (logger.log(LogRecord(0, rank))) nb_accepted++;
+  }
+  pipe.startReading();
+  logger.close();
+  AsyncLogger::Stats stats = logger.getStats();
+  EXPECT_GT(stats.nb_drops, 0u);
+  EXPECT_EQ(uint64_t(nb_accepted), stats.nb_records);
+  EXPECT_EQ(uint64_t(nb_records), stats.nb_records + stats.nb_drops);
+  std::vector<LogRecord> records = parseRecords(pipe.getData());
+  ASSERT_EQ(size_t(nb_accepted), records.size());
+  for (size_t idx = 1; idx < records.size(); idx++) {
+    ASSERT_LT(records[idx - 1].rank, records[idx].rank);
+  }
+}
+
+TEST(AsyncLogger, blockPolicyDoesNotLoseRecords)
+{
+  StalledPipe pipe(testing::TempDir() + "async_block.fifo");
+  AsyncLogger::Config config;
+  config.buffer_size = 1024;
+  config.nb_buffers = 2;
+  config.policy = AsyncLogger::OverflowPolicy::Block;
+  AsyncLogger logger(pipe.path, config);
+  // The pipe is only read once the logging thread has to wait
+  std::thread unblocker([&pipe]()
+                        {
+                          std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                          pipe.startReading();
+                        });
+  const int nb_records = 100000;
+  int nb_accepted = 0;
+  for (int rank = 0; rank < nb_records; rank++) {
+    if (logger.log(LogRecord(0, rank))) nb_accepted++;
+  }
+  unblocker.join();
+  EXPECT_EQ(nb_records, nb_accepted);
+  logger.close();
+  AsyncLogger::Stats stats = logger.getStats();
+  EXPECT_EQ(0u, stats.nb_drops);
+  EXPECT_EQ(uint64_t(nb_records), stats.nb_records);
+  EXPECT_GT(stats.max_enqueue_latency, 0.05);
+  std::vector<LogRecord> records = parseRecords(pipe.getData());
+  ASSERT_EQ(size_t(nb_records), records.size());
+  for (int rank = 0; rank < nb_records; rank++) {
+    ASSERT_EQ(rank, records[rank].rank);
+  }
+}
+
+TEST(AsyncLogger, flushPeriodWritesPartialBuffer)
+{
+  std::string path = testing::TempDir() + "async_flush_period.bin";
+  AsyncLogger::Config config;
+  config.flush_period = 0.05;
+  AsyncLogger logger(path, config);
+  logger.log(LogRecord(0, 42));
+  // Neither flush nor close is called, the record is written by the
+  // background thread alone
+  auto timeout = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (logger.getStats().nb_bytes_written < record_size &&
+         std::chrono::steady_clock::now() < timeout) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(record_size, logger.getStats().nb_bytes_written);
+  std::vector<LogRecord> records = parseRecords(readFile(path));
+  ASSERT_EQ(1u, records.size());
+  EXPECT_EQ(42, records[0].rank);
+  // Records logged afterwards use the same buffer
+  logger.log(LogRecord(0, 43));
+  logger.close();
+  records = parseRecords(readFile(path));
+  ASSERT_EQ(2u, records.size());
+  EXPECT_EQ(43, records[1].rank);
+  std::remove(path.c_str());
+}
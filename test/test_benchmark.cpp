@@ -0,0 +1,119 @@
+#include "rosban_utils/benchmark.h"
+#include "rosban_utils/multi_core.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <thread>
+
+using namespace rosban_utils;
+
+namespace
+{
+
+/// Return the line of 'text' describing the zone 'name', empty if there is none
+std::string findZone(const std::string & text, const std::string & name)
+{
+  std::istringstream iss(text);
+  std::string line;
+  while (std::getline(iss, line)) {
+    size_t pos = line.find(" ms : " + name);
+    if (pos == std::string::npos) continue;
+    size_t end = pos + 6 + name.size();
+    if (end == line.size() || line[end] == ' ') return line;
+  }
+  return "";
+}
+
+}
+
+TEST(Benchmark, parallelZonesAreMergedInCallingZone)
+{
+  std::ostringstream oss;
+  Benchmark::open("main");
+  for (int call = 0; call < 3; call++) {
+    Benchmark::open("parallel");
+    MultiCore::runParallelTask([](int start, int end)
+                               {
+                                 for (int idx = start; idx < end; idx++) {
+                                   Benchmark::Scope scope("task");
+                                 }
+                               }, 40, 4, MultiCore::Schedule(MultiCore::Schedule::Type::Static));
+    Benchmark::close();
+  }
+  Benchmark::close(true, -1, oss);
+  std::string task_line = findZone(oss.str(), "task");
+  EXPECT_NE(std::string::npos, task_line.find("(120 calls")) << oss.str();
+  // Zone is nested inside 'parallel': one more tabulation
+  EXPECT_EQ(0u, task_line.find("\t\t")) << oss.str();
+}
+
+TEST(Benchmark, unrelatedThreadsAreNotMerged)
+{
+  std::ostringstream main_output, thread_output;
+  Benchmark::open("main");
+  std::thread thread([&thread_output]()
+                     {
+                       Benchmark::open("other");
+                       Benchmark::close(true, -1, thread_output);
+                     });
+  thread.join();
+  Benchmark::close(true, -1, main_output);
+  EXPECT_EQ("", findZone(main_output.str(), "other")) << main_output.str();
+  EXPECT_NE("", findZone(thread_output.str(), "other"));
+}
+
+TEST(Benchmark, attachedThreadsAreMergedOnce)
+{
+  std::ostringstream oss;
+  Benchmark::open("main");
+  std::shared_ptr<Benchmark::WorkerGroup> group = Benchmark::getWorkerGroup();
+  for (int run = 0; run < 2; run++) {
+    std::thread thread([&group]()
+                       {
+                         Benchmark::Attachment attachment(group);
+                         Benchmark::open("worker");
+                         Benchmark::close();
+                       });
+    thread.join();
+  }
+  Benchmark::absorbThreadTrees();
+  // Trees are reset once absorbed, absorbing again does not count calls twice
+  Benchmark::absorbThreadTrees();
+  Benchmark::close(true, -1, oss);
+  EXPECT_NE(std::string::npos, findZone(oss.str(), "worker").find("(2 calls")) << oss.str();
+}
+
+TEST(Benchmark, reporterCopiesRunningTrees)
+{
+  std::ostringstream oss;
+  std::atomic<bool> stop(false);
+  Benchmark::setHistogramRecording(true);
+  std::thread thread([&stop]()
+                     {
+                       Benchmark::open("busy");
+                       while (!stop) {
+                         Benchmark::Scope step("step");
+                         MultiCore::runParallelTask([](int start, int end)
+                                                    {
+                                                      for (int idx = start; idx < end; idx++) {
+                                                        Benchmark::Scope scope("task");
+                                                      }
+                                                    }, 8, 2);
+                       }
+                       Benchmark::close();
+                     });
+  {
+    Benchmark::Reporter reporter(oss, 0.01);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    stop = true;
+    thread.join();
+  }
+  Benchmark::setHistogramRecording(false);
+  // Zones of the workers are copied inside the zone of the calling thread
+  std::string task_line = findZone(oss.str(), "task");
+  EXPECT_EQ(0u, task_line.find("\t\t")) << oss.str();
+  EXPECT_NE("", findZone(oss.str(), "busy")) << oss.str();
+}
@@ -0,0 +1,233 @@
+#include "rosban_utils/io_tools.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <sstream>
+#include <vector>
+
+using namespace rosban_utils;
+
+namespace
+{
+
+/// Stream containing 'nb_ints' consecutive integers starting at 0
+std::string makeIntStream(int nb_ints)
+{
+  std::ostringstream oss;
+  for (int i = 0; i < nb_ints; i++) {
+    write<int>(oss, i);
+  }
+  return oss.str();
+}
+
+/// Not a multiple of the block size of the codecs
+const int nb_codec_values = 1000;
+
+}
+
+TEST(BinaryReader, streamReadLargerThanBufferWithBufferedBytes)
+{
+  // 80 kB read while most of the 64 kB buffer is still available, the
+  // buffer has to grow while keeping the pending bytes
+  std::istringstream iss(makeIntStream(30000));
+  BinaryReader reader(iss, 1 << 16);
+  EXPECT_EQ(0, reader.read<int>());
+  std::vector<int> values(20000);
+  reader.readArray<int>(values.data(), values.size());
+  for (size_t i = 0; i < values.size(); i++) {
+    ASSERT_EQ((int)i + 1, values[i]);
+  }
+  EXPECT_EQ(20001, reader.read<int>());
+  EXPECT_EQ(20002 * sizeof(int), reader.getNbBytesRead());
+}
+
+TEST(BinaryReader, streamGetPointerLargerThanBuffer)
+{
+  std::istringstream iss(makeIntStream(100000));
+  BinaryReader reader(iss, 1 << 16);
+  EXPECT_EQ(0, reader.read<int>());
+  const int * values = reinterpret_cast<const int *>(reader.getPointer(50000 * sizeof(int)));
+  for (int i = 0; i < 50000; i++) {
+    ASSERT_EQ(i + 1, values[i]);
+  }
+  EXPECT_EQ(50001, reader.read<int>());
+}
+
+TEST(BinaryReader, streamUnexpectedEnd)
+{
+  std::istringstream iss(makeIntStream(10));
+  BinaryReader reader(iss, 64);
+  EXPECT_EQ(0, reader.read<int>());
+  EXPECT_THROW(reader.getPointer(100), std::runtime_error);
+}
+
+TEST(Codecs, streamRoundTrip)
+{
+  std::vector<int> ints(nb_codec_values);
+  std::vector<double> doubles(nb_codec_values);
+  for (int i = 0; i < nb_codec_values; i++) {
+    ints[i] = (i % 7 == 0) ? -i * 1000 : 3 * i;
+    doubles[i] = std::sin(0.01 * i) + (i % 3 == 0 ? 1e6 : 0);
+  }
+  double tolerance = 1e-4;
+  std::ostringstream oss;
+  int nb_bytes = 0;
+  nb_bytes += writeVarIntArray(oss, ints.data(), nb_codec_values);
+  nb_bytes += writeDeltaIntArray(oss, ints.data(), nb_codec_values);
+  nb_bytes += writeXorDoubleArray(oss, doubles.data(), nb_codec_values);
+  nb_bytes += writeQuantizedDoubleArray(oss, doubles.data(), nb_codec_values, tolerance);
+  nb_bytes += write<int>(oss, 42);
+  ASSERT_EQ((int)oss.str().size(), nb_bytes);
+
+  std::istringstream iss(oss.str());
+  std::vector<int> read_ints(nb_codec_values);
+  std::vector<double> read_doubles(nb_codec_values);
+  int nb_bytes_read = readVarIntArray(iss, read_ints.data(), nb_codec_values);
+  EXPECT_EQ(ints, read_ints);
+  nb_bytes_read += readDeltaIntArray(iss, read_ints.data(), nb_codec_values);
+  EXPECT_EQ(ints, read_ints);
+  nb_bytes_read += readXorDoubleArray(iss, read_doubles.data(), nb_codec_values);
+  EXPECT_EQ(doubles, read_doubles);
+  nb_bytes_read += readQuantizedDoubleArray(iss, read_doubles.data(), nb_codec_values);
+  for (int i = 0; i < nb_codec_values; i++) {
+    ASSERT_NEAR(doubles[i], read_doubles[i], tolerance * (1 + 1e-6));
+  }
+  // Readers do not consume anything beyond the encoded data
+  EXPECT_EQ((std::streamoff)nb_bytes_read, (std::streamoff)iss.tellg());
+  int last = 0;
+  read<int>(iss, &last);
+  EXPECT_EQ(42, last);
+}
+
+TEST(Eigen, matrixRoundTrip)
+{
+  Eigen::Matrix3d fixed = Eigen::Matrix3d::Random();
+  Eigen::Vector4d vector = Eigen::Vector4d::Random();
+  Eigen::MatrixXd dynamic = Eigen::MatrixXd::Random(2, 5);
+  Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> row_major =
+    Eigen::MatrixXd::Random(3, 2);
+  Eigen::MatrixXd empty(0, 4);
+  BinaryWriter writer;
+  int nb_bytes = 0;
+  nb_bytes += write(writer, fixed);
+  nb_bytes += write(writer, vector);
+  nb_bytes += write(writer, dynamic);
+  nb_bytes += write(writer, row_major);
+  nb_bytes += write(writer, empty);
+  EXPECT_EQ((int)(10 * sizeof(int) + (9 + 4 + 10 + 6) * sizeof(double)), nb_bytes);
+  ASSERT_EQ((size_t)nb_bytes, writer.getSize());
+  // Same data through std::ostream
+  std::ostringstream oss;
+  writeMatrix(oss, fixed);
+  writeMatrix(oss, vector);
+  writeMatrix(oss, dynamic);
+  writeMatrix(oss, row_major);
+  writeMatrix(oss, empty);
+  ASSERT_EQ(std::string(writer.getData(), writer.getSize()), oss.str());
+
+  BinaryReader reader(writer.getData(), writer.getSize());
+  Eigen::Matrix3d read_fixed;
+  Eigen::Vector4d read_vector;
+  // Allocation of the right size is reused
+  Eigen::MatrixXd read_dynamic(2, 5);
+  const double * dynamic_data = read_dynamic.data();
+  Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> read_row_major;
+  Eigen::MatrixXd read_empty;
+  int nb_bytes_read = 0;
+  nb_bytes_read += read(reader, &read_fixed);
+  nb_bytes_read += read(reader, &read_vector);
+  nb_bytes_read += read(reader, &read_dynamic);
+  nb_bytes_read += read(reader, &read_row_major);
+  nb_bytes_read += read(reader, &read_empty);
+  EXPECT_EQ(nb_bytes, nb_bytes_read);
+  EXPECT_TRUE(reader.isEnd());
+  EXPECT_EQ(fixed, read_fixed);
+  EXPECT_EQ(vector, read_vector);
+  EXPECT_EQ(dynamic, read_dynamic);
+  EXPECT_EQ(dynamic_data, read_dynamic.data());
+  EXPECT_EQ(row_major, read_row_major);
+  EXPECT_EQ(0, read_empty.rows());
+  EXPECT_EQ(4, read_empty.cols());
+
+  std::istringstream iss(oss.str());
+  Eigen::MatrixXd streamed;
+  readMatrix(iss, &read_fixed);
+  readMatrix(iss, &read_vector);
+  readMatrix(iss, &streamed);
+  EXPECT_EQ(fixed, read_fixed);
+  EXPECT_EQ(vector, read_vector);
+  EXPECT_EQ(dynamic, streamed);
+}
+
+TEST(Eigen, readMatrixRejectsShape)
+{
+  BinaryWriter writer;
+  writeMatrix(writer, Eigen::MatrixXd(Eigen::MatrixXd::Zero(2, 3)));
+  Eigen::Matrix3d fixed;
+  {
+    BinaryReader reader(writer.getData(), writer.getSize());
+    EXPECT_THROW(readMatrix(reader, &fixed), std::runtime_error);
+  }
+  Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, 0, 2, 2> bounded;
+  {
+    BinaryReader reader(writer.getData(), writer.getSize());
+    EXPECT_THROW(readMatrix(reader, &bounded), std::runtime_error);
+  }
+  Eigen::Vector2d vector;
+  {
+    BinaryReader reader(writer.getData(), writer.getSize());
+    EXPECT_THROW(readMatrix(reader, &vector), std::runtime_error);
+  }
+  // Negative dimensions
+  writer.clear();
+  writer.write<int>(-1);
+  writer.write<int>(3);
+  Eigen::MatrixXd dynamic;
+  {
+    BinaryReader reader(writer.getData(), writer.getSize());
+    EXPECT_THROW(readMatrix(reader, &dynamic), std::runtime_error);
+  }
+}
+
+TEST(Eigen, vectorsRoundTrip)
+{
+  std::vector<Eigen::VectorXd> same_size(5), mixed;
+  for (Eigen::VectorXd & vector : same_size) {
+    vector = Eigen::VectorXd::Random(3);
+  }
+  for (int dim = 0; dim < 4; dim++) {
+    mixed.push_back(Eigen::VectorXd::Random(dim));
+  }
+  std::vector<Eigen::VectorXd> empty;
+  BinaryWriter writer;
+  int nb_bytes = writeVectors(writer, same_size);
+  EXPECT_EQ((int)(2 * sizeof(int) + 15 * sizeof(double)), nb_bytes);
+  nb_bytes += writeVectors(writer, mixed);
+  nb_bytes += writeVectors(writer, empty);
+  ASSERT_EQ((size_t)nb_bytes, writer.getSize());
+  std::ostringstream oss;
+  writeVectors(oss, same_size);
+  writeVectors(oss, mixed);
+  writeVectors(oss, empty);
+  ASSERT_EQ(std::string(writer.getData(), writer.getSize()), oss.str());
+
+  BinaryReader reader(writer.getData(), writer.getSize());
+  // Existing vectors of the right dimension are reused
+  std::vector<Eigen::VectorXd> read_vectors(5, Eigen::VectorXd(3));
+  const double * first_data = read_vectors[0].data();
+  int nb_bytes_read = readVectors(reader, &read_vectors);
+  EXPECT_EQ(same_size, read_vectors);
+  EXPECT_EQ(first_data, read_vectors[0].data());
+  nb_bytes_read += readVectors(reader, &read_vectors);
+  EXPECT_EQ(mixed, read_vectors);
+  nb_bytes_read += readVectors(reader, &read_vectors);
+  EXPECT_TRUE(read_vectors.empty());
+  EXPECT_EQ(nb_bytes, nb_bytes_read);
+
+  std::istringstream iss(oss.str());
+  readVectors(iss, &read_vectors);
+  EXPECT_EQ(same_size, read_vectors);
+  readVectors(iss, &read_vectors);
+  EXPECT_EQ(mixed, read_vectors);
+}
@@ -0,0 +1,105 @@
+#include "rosban_utils/latency_histogram.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+using namespace rosban_utils;
+
+namespace
+{
+
+/// Relative error bound of the histogram, see SUB_BUCKETS_BITS
+const double max_relative_error = 1.0 / 32;
+
+/// Check that the percentiles of 'histogram' are the ones of the values
+/// [first, last], within the bounded relative error
+void expectPercentilesOfRange(const LatencyHistogram & histogram, uint64_t first, uint64_t last)
+{
+  uint64_t nb_values = last - first + 1;
+  ASSERT_EQ(nb_values, histogram.getNbValues());
+  for (double percentile : {0.1, 1.0, 10.0, 50.0, 90.0, 99.0, 99.9, 100.0}) {
+    uint64_t rank = std::max((uint64_t)1, (uint64_t)std::ceil(percentile / 100 * nb_values));
+    uint64_t expected = first + rank - 1;
+    uint64_t value = histogram.getPercentile(percentile);
+    EXPECT_GE(value, expected) << "percentile " << percentile;
+    EXPECT_LE(value, expected * (1 + max_relative_error)) << "percentile " << percentile;
+  }
+}
+
+}
+
+TEST(LatencyHistogram, smallValuesAreExact)
+{
+  LatencyHistogram histogram;
+  EXPECT_EQ(0u, histogram.getPercentile(50));
+  for (uint64_t value = 0; value < 32; value++) {
+    histogram.record(value);
+  }
+  EXPECT_EQ(32u, histogram.getNbValues());
+  EXPECT_EQ(0u, histogram.getMin());
+  EXPECT_EQ(31u, histogram.getMax());
+  EXPECT_EQ(0u, histogram.getPercentile(0));
+  EXPECT_EQ(15u, histogram.getPercentile(50));
+  EXPECT_EQ(31u, histogram.getPercentile(100));
+  EXPECT_THROW(histogram.getPercentile(-1), std::logic_error);
+  EXPECT_THROW(histogram.getPercentile(101), std::logic_error);
+}
+
+TEST(LatencyHistogram, percentilesHaveBoundedError)
+{
+  LatencyHistogram histogram;
+  for (uint64_t value = 1000; value <= 1000000; value++) {
+    histogram.record(value);
+  }
+  EXPECT_EQ(1000u, histogram.getMin());
+  EXPECT_EQ(1000000u, histogram.getMax());
+  expectPercentilesOfRange(histogram, 1000, 1000000);
+  // Large values, up to the highest bucket
+  LatencyHistogram large;
+  large.record(std::numeric_limits<uint64_t>::max());
+  large.record(uint64_t(1) << 40);
+  EXPECT_EQ(std::numeric_limits<uint64_t>::max(), large.getPercentile(100));
+  EXPECT_EQ(uint64_t(1) << 40, large.getMin());
+  histogram.reset();
+  EXPECT_EQ(0u, histogram.getNbValues());
+  EXPECT_EQ(0u, histogram.getPercentile(99));
+}
+
+TEST(LatencyHistogram, mergeAndSubtract)
+{
+  LatencyHistogram first, second, all;
+  for (uint64_t value = 100; value < 5000; value++) {
+    first.record(value);
+    all.record(value);
+  }
+  for (uint64_t value = 5000; value <= 200000; value++) {
+    second.record(value);
+    all.record(value);
+  }
+  LatencyHistogram merged;
+  merged.merge(second);
+  merged.merge(first);
+  EXPECT_EQ(all.getNbValues(), merged.getNbValues());
+  EXPECT_EQ(100u, merged.getMin());
+  EXPECT_EQ(200000u, merged.getMax());
+  for (double percentile : {1.0, 25.0, 50.0, 99.0}) {
+    EXPECT_EQ(all.getPercentile(percentile), merged.getPercentile(percentile));
+  }
+  // Values recorded since 'first' was copied
+  merged.subtract(first);
+  expectPercentilesOfRange(merged, 5000, 200000);
+  // Min and max are the bounds of the buckets
+  EXPECT_LE(merged.getMin(), 5000u);
+  EXPECT_GE(merged.getMin(), 5000 * (1 - max_relative_error));
+  EXPECT_EQ(200000u, merged.getMax());
+  EXPECT_THROW(merged.subtract(all), std::logic_error);
+  EXPECT_THROW(first.subtract(second), std::logic_error);
+  merged.subtract(second);
+  EXPECT_EQ(0u, merged.getNbValues());
+  EXPECT_EQ(0u, merged.getMin());
+  EXPECT_EQ(0u, merged.getMax());
+}
@@ -0,0 +1,82 @@
+#include "rosban_utils/io_tools.h"
+#include "rosban_utils/mapped_file.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace rosban_utils;
+
+namespace
+{
+
+void writeFile(const std::string & path, const std::string & content)
+{
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(content.data(), content.size());
+}
+
+}
+
+TEST(MappedFile, emptyFile)
+{
+  std::string path = testing::TempDir() + "empty.bin";
+  writeFile(path, "");
+  std::shared_ptr<MappedFile> file(new MappedFile(path));
+  EXPECT_EQ(nullptr, file->getData());
+  EXPECT_EQ(0u, file->getSize());
+  // Hints on an empty range are accepted
+  file->advise(0, 0, MappedFile::Access::Random);
+  file->release(0, 0);
+  BinaryReader reader(file);
+  EXPECT_TRUE(reader.isEnd());
+  EXPECT_THROW(reader.read<int>(), std::runtime_error);
+  std::remove(path.c_str());
+}
+
+TEST(MappedFile, missingFileThrows)
+{
+  std::string path = testing::TempDir() + "missing_mapped_file.bin";
+  std::remove(path.c_str());
+  try {
+    MappedFile file(path);
+    FAIL() << "no exception for a missing file";
+  }
+  catch (const std::runtime_error & exc) {
+    // Message contains the path
+    EXPECT_NE(std::string::npos, std::string(exc.what()).find(path));
+  }
+}
+
+TEST(MappedFile, readerMatchesFileContent)
+{
+  std::string path = testing::TempDir() + "mapped_values.bin";
+  // Larger than the size above which pages are released once copied
+  std::vector<double> values(1000000);
+  for (size_t idx = 0; idx < values.size(); idx++) {
+    values[idx] = idx * 0.25;
+  }
+  {
+    std::ofstream out(path, std::ios::binary);
+    write<int>(out, 42);
+    writeDoubleArray(out, values.data(), values.size());
+  }
+  std::shared_ptr<MappedFile> file(new MappedFile(path));
+  EXPECT_EQ(sizeof(int) + values.size() * sizeof(double), file->getSize());
+  BinaryReader reader(file);
+  EXPECT_EQ(42, reader.read<int>());
+  std::vector<double> read_values(values.size());
+  reader.readArray<double>(read_values.data(), read_values.size());
+  EXPECT_EQ(values, read_values);
+  EXPECT_TRUE(reader.isEnd());
+  // Released pages are read again from the file
+  file->release(0, file->getSize());
+  EXPECT_EQ(0, std::memcmp(file->getData() + sizeof(int), values.data(),
+                           values.size() * sizeof(double)));
+  std::remove(path.c_str());
+}
@@ -0,0 +1,176 @@
+#include "rosban_utils/micro_benchmark.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+using namespace rosban_utils;
+
+namespace
+{
+
+/// Busy wait for 'duration' seconds
+void spin(double duration)
+{
+  auto end = std::chrono::steady_clock::now() +
+    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(duration));
+  while (std::chrono::steady_clock::now() < end) {}
+}
+
+MicroBenchmark::Config getFastConfig()
+{
+  MicroBenchmark::Config config;
+  config.warmup_time = 0.001;
+  config.target_time = 0.002;
+  config.nb_repetitions = 10;
+  return config;
+}
+
+/// Result with the given mean and 95% confidence interval [mean - half_width, mean + half_width]
+MicroBenchmark::Result makeResult(const std::string & name, double mean, double half_width)
+{
+  MicroBenchmark::Result result;
+  result.name = name;
+  result.nb_iterations = 100;
+  result.nb_repetitions = 10;
+  result.mean = mean;
+  result.median = mean;
+  result.stddev = half_width;
+  result.min = mean - 2 * half_width;
+  result.max = mean + 2 * half_width;
+  result.ci_low = mean - half_width;
+  result.ci_high = mean + half_width;
+  return result;
+}
+
+void writeBaseline(const std::string & path, const std::vector<MicroBenchmark::Result> & results)
+{
+  std::ofstream out(path);
+  out.precision(17);
+  for (const MicroBenchmark::Result & r : results) {
+    out << r.nb_iterations << " " << r.nb_repetitions << " " << r.mean << " " << r.median << " "
+        << r.stddev << " " << r.min << " " << r.max << " " << r.ci_low << " " << r.ci_high << " "
+        << r.name << std::endl;
+  }
+}
+
+}
+
+TEST(MicroBenchmark, invalidConfigThrows)
+{
+  MicroBenchmark::Config config = getFastConfig();
+  config.nb_repetitions = 1;
+  EXPECT_THROW(MicroBenchmark benchmark(config), std::logic_error);
+  config = getFastConfig();
+  config.target_time = 0;
+  EXPECT_THROW(MicroBenchmark benchmark(config), std::logic_error);
+}
+
+TEST(MicroBenchmark, runMeasuresIterations)
+{
+  MicroBenchmark benchmark(getFastConfig());
+  const double task_duration = 20e-6;
+  const MicroBenchmark::Result & result = benchmark.run("spin", [task_duration]() { spin(task_duration); });
+  EXPECT_EQ("spin", result.name);
+  EXPECT_EQ(10, result.nb_repetitions);
+  // Each repetition lasts at least target_time
+  EXPECT_GE(result.nb_iterations * task_duration * 1.5, 0.002);
+  EXPECT_GE(result.min, task_duration);
+  EXPECT_LE(result.min, result.median);
+  EXPECT_LE(result.median, result.max);
+  EXPECT_LE(result.min, result.mean);
+  EXPECT_LE(result.mean, result.max);
+  EXPECT_LE(result.ci_low, result.mean);
+  EXPECT_GE(result.ci_high, result.mean);
+  EXPECT_GE(result.stddev, 0);
+  ASSERT_EQ(1u, benchmark.getResults().size());
+  EXPECT_EQ("spin", benchmark.getResults()[0].name);
+}
+
+TEST(MicroBenchmark, baselineRoundTrip)
+{
+  std::string path = testing::TempDir() + "micro_benchmark_baseline.txt";
+  MicroBenchmark benchmark(getFastConfig());
+  benchmark.run("first task", []() { spin(1e-6); });
+  benchmark.run("second", []() { spin(2e-6); });
+  benchmark.saveBaseline(path);
+  std::vector<MicroBenchmark::Result> baseline = MicroBenchmark::loadBaseline(path);
+  const std::vector<MicroBenchmark::Result> & results = benchmark.getResults();
+  ASSERT_EQ(results.size(), baseline.size());
+  for (size_t idx = 0; idx < results.size(); idx++) {
+    EXPECT_EQ(results[idx].name, baseline[idx].name);
+    EXPECT_EQ(results[idx].nb_iterations, baseline[idx].nb_iterations);
+    EXPECT_EQ(results[idx].nb_repetitions, baseline[idx].nb_repetitions);
+    EXPECT_EQ(results[idx].mean, baseline[idx].mean);
+    EXPECT_EQ(results[idx].median, baseline[idx].median);
+    EXPECT_EQ(results[idx].stddev, baseline[idx].stddev);
+    EXPECT_EQ(results[idx].min, baseline[idx].min);
+    EXPECT_EQ(results[idx].max, baseline[idx].max);
+    EXPECT_EQ(results[idx].ci_low, baseline[idx].ci_low);
+    EXPECT_EQ(results[idx].ci_high, baseline[idx].ci_high);
+    EXPECT_EQ(MicroBenchmark::Status::Unchanged, benchmark.compare(results[idx], baseline));
+  }
+  std::ostringstream out;
+  EXPECT_EQ(0, benchmark.compareToBaseline(path, out));
+  std::remove(path.c_str());
+}
+
+TEST(MicroBenchmark, loadBaselineErrors)
+{
+  EXPECT_THROW(MicroBenchmark::loadBaseline(testing::TempDir() + "missing_baseline.txt"),
+               std::runtime_error);
+  std::string path = testing::TempDir() + "micro_benchmark_invalid.txt";
+  {
+    std::ofstream out(path);
+    out << "# comment" << std::endl << "12 not_a_number" << std::endl;
+  }
+  EXPECT_THROW(MicroBenchmark::loadBaseline(path), std::runtime_error);
+  std::remove(path.c_str());
+}
+
+TEST(MicroBenchmark, compareUsesThresholdAndIntervals)
+{
+  MicroBenchmark::Config config = getFastConfig();
+  config.regression_threshold = 0.05;
+  MicroBenchmark benchmark(config);
+  std::vector<MicroBenchmark::Result> baseline = { makeResult("task", 1.0, 0.01) };
+  typedef MicroBenchmark::Status Status;
+  EXPECT_EQ(Status::Unchanged, benchmark.compare(makeResult("task", 1.0, 0.01), baseline));
+  EXPECT_EQ(Status::New, benchmark.compare(makeResult("other", 1.0, 0.01), baseline));
+  // Significant and non-overlapping
+  EXPECT_EQ(Status::Regression, benchmark.compare(makeResult("task", 1.1, 0.01), baseline));
+  EXPECT_EQ(Status::Improvement, benchmark.compare(makeResult("task", 0.9, 0.01), baseline));
+  // Below the threshold, even with non-overlapping intervals
+  EXPECT_EQ(Status::Unchanged, benchmark.compare(makeResult("task", 1.04, 0.001), baseline));
+  EXPECT_EQ(Status::Unchanged, benchmark.compare(makeResult("task", 0.96, 0.001), baseline));
+  // Above the threshold, but the intervals overlap
+  EXPECT_EQ(Status::Unchanged, benchmark.compare(makeResult("task", 1.1, 0.2), baseline));
+  EXPECT_EQ(Status::Unchanged, benchmark.compare(makeResult("task", 0.9, 0.2), baseline));
+}
+
+TEST(MicroBenchmark, compareToBaselineCountsRegressions)
+{
+  std::string path = testing::TempDir() + "micro_benchmark_compare.txt";
+  MicroBenchmark benchmark(getFastConfig());
+  for (const char * name : {"slower", "also slower", "faster", "same", "new"}) {
+    benchmark.run(name, []() { spin(20e-6); });
+  }
+  const std::vector<MicroBenchmark::Result> & results = benchmark.getResults();
+  // Durations far from the measured ones: 1 ps and 1 s per iteration
+  writeBaseline(path, { makeResult("slower", 1e-12, 0), makeResult("also slower", 1e-12, 0),
+                        makeResult("faster", 1, 0), results[3] });
+  std::ostringstream out;
+  EXPECT_EQ(2, benchmark.compareToBaseline(path, out));
+  std::string report = out.str();
+  EXPECT_NE(std::string::npos, report.find("slower: "));
+  EXPECT_NE(std::string::npos, report.find("REGRESSION"));
+  EXPECT_NE(std::string::npos, report.find("improvement"));
+  EXPECT_NE(std::string::npos, report.find("new: "));
+  EXPECT_NE(std::string::npos, report.find("(new)"));
+  std::remove(path.c_str());
+}
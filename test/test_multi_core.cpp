@@ -0,0 +1,360 @@
+#include "rosban_utils/multi_core.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace rosban_utils;
+
+namespace
+{
+
+/// Job waiting until 'nb_jobs' jobs are running at the same time or until a
+/// timeout of 5 seconds, count the jobs which have seen all the others
+struct RendezVousJob
+{
+  RendezVousJob(int nb_jobs_) : nb_jobs(nb_jobs_), nb_started(0), nb_met(0) {}
+
+  void operator()(int)
+    {
+      nb_started++;
+      auto timeout = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+      while (nb_started.load() < nb_jobs && std::chrono::steady_clock::now() < timeout) {
+        std::this_thread::yield();
+      }
+      if (nb_started.load() >= nb_jobs) nb_met++;
+    }
+
+  int nb_jobs;
+  std::atomic<int> nb_started;
+  std::atomic<int> nb_met;
+};
+
+}
+
+TEST(Pool, nestedRunFromCallingThread)
+{
+  MultiCore::Pool pool(2);
+  std::atomic<int> nb_inner_jobs(0);
+  pool.run(2, [&pool, &nb_inner_jobs](int)
+           {
+             pool.run(3, [&nb_inner_jobs](int) { nb_inner_jobs++; });
+           });
+  EXPECT_EQ(6, nb_inner_jobs.load());
+  // Pool is usable again once the nested calls are over
+  std::atomic<int> nb_jobs(0);
+  pool.run(4, [&nb_jobs](int) { nb_jobs++; });
+  EXPECT_EQ(4, nb_jobs.load());
+}
+
+TEST(Pool, workersAddedByRunProcessTheBatch)
+{
+  // Workers are created by run, all of them are needed for the jobs to meet
+  MultiCore::Pool pool(1);
+  RendezVousJob job(4);
+  pool.run(4, std::ref(job));
+  EXPECT_EQ(4, pool.getNbThreads());
+  EXPECT_EQ(4, job.nb_met.load());
+}
+
+TEST(Pool, pinnedPoolGrowsInsideRun)
+{
+  MultiCore::Pool pool(1);
+  pool.setPlacement(MultiCore::Pool::Placement(MultiCore::Pool::Placement::Type::Compact));
+  // With pinned workers, job 'i' can only be run by worker 'i'
+  std::vector<int> nb_runs(4, 0);
+  pool.run(4, [&nb_runs](int job_idx) { nb_runs[job_idx]++; });
+  EXPECT_EQ(std::vector<int>(4, 1), nb_runs);
+  EXPECT_EQ(5, pool.getNbThreads());
+}
+
+TEST(MultiCore, schedulesProcessEachTaskOnce)
+{
+  const int nb_tasks = 1003;
+  const int nb_threads = 4;
+  std::vector<MultiCore::Schedule> schedules = {
+    MultiCore::Schedule(MultiCore::Schedule::Type::Static),
+    MultiCore::Schedule(MultiCore::Schedule::Type::Dynamic, 7),
+    MultiCore::Schedule(MultiCore::Schedule::Type::WorkStealing, 5)
+  };
+  for (const MultiCore::Schedule & schedule : schedules) {
+    std::vector<std::atomic<int>> nb_visits(nb_tasks);
+    std::atomic<int> nb_calls(0), max_chunk(0);
+    MultiCore::RunStats stats;
+    MultiCore::runParallelTask([&](int start, int end)
+                               {
+                                 nb_calls++;
+                                 int chunk = end - start;
+                                 int current = max_chunk.load();
+                                 while (chunk > current && !max_chunk.compare_exchange_weak(current, chunk));
+                                 for (int idx = start; idx < end; idx++) {
+                                   nb_visits[idx]++;
+                                 }
+                               }, nb_tasks, nb_threads, schedule, &stats);
+    for (int idx = 0; idx < nb_tasks; idx++) {
+      ASSERT_EQ(1, nb_visits[idx].load()) << "task " << idx;
+    }
+    ASSERT_EQ((size_t)nb_threads, stats.busy_times.size());
+    ASSERT_EQ((size_t)nb_threads, stats.nb_tasks.size());
+    ASSERT_EQ((size_t)nb_threads, stats.nb_chunks.size());
+    ASSERT_EQ((size_t)nb_threads, stats.nb_steals.size());
+    int nb_counted_tasks = 0, nb_counted_chunks = 0;
+    for (int thread_no = 0; thread_no < nb_threads; thread_no++) {
+      nb_counted_tasks += stats.nb_tasks[thread_no];
+      nb_counted_chunks += stats.nb_chunks[thread_no];
+      EXPECT_GE(stats.busy_times[thread_no], 0);
+      EXPECT_LE(stats.busy_times[thread_no], stats.wall_time);
+    }
+    EXPECT_EQ(nb_tasks, nb_counted_tasks);
+    EXPECT_EQ(nb_calls.load(), nb_counted_chunks);
+    EXPECT_GE(stats.getImbalance(), 1);
+    EXPECT_GT(stats.getEfficiency(), 0);
+    EXPECT_LE(stats.getEfficiency(), 1);
+    if (schedule.type == MultiCore::Schedule::Type::Static) {
+      EXPECT_EQ(nb_threads, nb_calls.load());
+    }
+    else {
+      EXPECT_LE(max_chunk.load(), schedule.grain);
+    }
+    if (schedule.type != MultiCore::Schedule::Type::WorkStealing) {
+      for (int nb_steals : stats.nb_steals) {
+        EXPECT_EQ(0, nb_steals);
+      }
+    }
+  }
+}
+
+TEST(MultiCore, workStealingBalancesSlowBlock)
+{
+  // Only the static block of the first thread is slow
+  const int nb_tasks = 400;
+  const int nb_threads = 4;
+  MultiCore::RunStats stats;
+  MultiCore::runParallelTask([](int start, int end)
+                             {
+                               for (int idx = start; idx < end; idx++) {
+                                 if (idx < nb_tasks / nb_threads) {
+                                   std::this_thread::sleep_for(std::chrono::microseconds(500));
+                                 }
+                               }
+                             }, nb_tasks, nb_threads,
+                             MultiCore::Schedule(MultiCore::Schedule::Type::WorkStealing, 2),
+                             &stats);
+  int nb_steals = 0;
+  for (int thread_no = 1; thread_no < nb_threads; thread_no++) {
+    nb_steals += stats.nb_steals[thread_no];
+  }
+  EXPECT_GT(nb_steals, 0);
+  // Thread 0 did not process its whole block
+  EXPECT_LT(stats.nb_tasks[0], nb_tasks / nb_threads);
+}
+
+TEST(MultiCore, seededTasksDoNotDependOnThreads)
+{
+  const int nb_tasks = 1000;
+  std::vector<uint64_t> single(nb_tasks), multi(nb_tasks);
+  MultiCore::runParallelSeededTask([&single](int task_idx, MultiCore::TaskEngine * engine)
+                                   {
+                                     (*engine)();
+                                     single[task_idx] = (*engine)();
+                                   }, nb_tasks, 1, 42);
+  MultiCore::runParallelSeededTask([&multi](int task_idx, MultiCore::TaskEngine * engine)
+                                   {
+                                     (*engine)();
+                                     multi[task_idx] = (*engine)();
+                                   }, nb_tasks, 4, 42);
+  EXPECT_EQ(single, multi);
+  // Full 64 bits values, no collision between the streams of the tasks
+  std::sort(single.begin(), single.end());
+  EXPECT_TRUE(std::adjacent_find(single.begin(), single.end()) == single.end());
+  EXPECT_GT(single.back(), (uint64_t)1 << 32);
+}
+
+TEST(MultiCore, taskEngineWithDistributions)
+{
+  MultiCore::TaskEngine engine(MultiCore::getTaskSeed(42, 3));
+  std::uniform_real_distribution<double> distribution(0, 1);
+  for (int i = 0; i < 1000; i++) {
+    double value = distribution(engine);
+    ASSERT_GE(value, 0);
+    ASSERT_LT(value, 1);
+  }
+}
+
+TEST(MultiCore, cancelledTasksOnlyCountProcessedIndices)
+{
+  MultiCore::CancellationToken token;
+  std::atomic<int> nb_done(0);
+  MultiCore::RunStats stats;
+  // Task 500 cancels the run and stops right after it
+  MultiCore::Completion completion =
+    MultiCore::runCancellableTask([&nb_done, &token](int start, int end,
+                                                     const MultiCore::CancellationToken & run_token)
+                                  {
+                                    for (int idx = start; idx < end; idx++) {
+                                      if (run_token.isCancelled()) return idx;
+                                      nb_done++;
+                                      if (idx == 500) token.cancel();
+                                    }
+                                    return end;
+                                  },
+                                  1000, 2, token, MultiCore::Schedule(MultiCore::Schedule::Type::Static),
+                                  &stats);
+  EXPECT_FALSE(completion.complete);
+  EXPECT_EQ(nb_done.load(), completion.nb_processed);
+  int nb_counted = 0;
+  for (int nb_tasks : stats.nb_tasks) {
+    nb_counted += nb_tasks;
+  }
+  EXPECT_EQ(nb_done.load(), nb_counted);
+}
+
+TEST(MultiCore, parallelReduceDoesNotDependOnThreads)
+{
+  // Magnitudes spanning several orders make the sum sensitive to the order
+  auto map = [](int idx) { return std::sin(idx) * std::pow(10.0, idx % 17 - 8); };
+  auto combine = [](double a, double b) { return a + b; };
+  for (int nb_tasks : {1, 7, 255, 1000, 100003}) {
+    double reference = MultiCore::parallelReduce(0.0, map, combine, nb_tasks, 1);
+    for (int nb_threads : {2, 3, 4, 8, 13}) {
+      double result = MultiCore::parallelReduce(0.0, map, combine, nb_tasks, nb_threads);
+      ASSERT_EQ(0, std::memcmp(&reference, &result, sizeof(double)))
+        << "nb_tasks: " << nb_tasks << ", nb_threads: " << nb_threads;
+    }
+  }
+}
+
+TEST(MultiCore, parallelReduceWithoutDefaultConstructor)
+{
+  struct Sum
+  {
+    explicit Sum(long value_) : value(value_) {}
+    long value;
+  };
+  Sum result = MultiCore::parallelReduce(Sum(0),
+                                         [](int idx) { return Sum(idx); },
+                                         [](const Sum & a, const Sum & b) { return Sum(a.value + b.value); },
+                                         1000, 4);
+  EXPECT_EQ(999 * 1000 / 2, result.value);
+}
+
+TEST(MultiCore, asyncErrorsPropagateThroughDependencies)
+{
+  // The failing task waits for the gate, dependents are thus registered
+  // before it finishes
+  std::promise<void> gate;
+  std::shared_future<void> gate_future = gate.get_future().share();
+  MultiCore::AsyncHandle failing =
+    MultiCore::runAsyncTask([gate_future](int start, int)
+                            {
+                              gate_future.wait();
+                              if (start == 0) throw std::runtime_error("failing task");
+                            }, 4, 2);
+  std::vector<int> values(100, 0);
+  MultiCore::AsyncHandle independent =
+    MultiCore::runAsyncTask([&values](int start, int end)
+                            {
+                              for (int idx = start; idx < end; idx++) values[idx] = idx;
+                            }, 100, 4);
+  std::atomic<int> nb_dependent_runs(0);
+  auto dependent_task = [&nb_dependent_runs](int, int) { nb_dependent_runs++; };
+  MultiCore::AsyncHandle child = MultiCore::runAsyncTask(dependent_task, 10, 2, {failing});
+  MultiCore::AsyncHandle grand_child = MultiCore::runAsyncTask(dependent_task, 10, 2, {child});
+  MultiCore::AsyncHandle diamond =
+    MultiCore::runAsyncTask(dependent_task, 1, 1, {independent, grand_child});
+  // Only depends on the independent task, which succeeds
+  long sum = 0;
+  MultiCore::AsyncHandle reader =
+    MultiCore::runAsyncTask([&values, &sum](int, int)
+                            {
+                              for (int value : values) sum += value;
+                            }, 1, 1, {independent});
+  EXPECT_FALSE(failing.isReady());
+  gate.set_value();
+  EXPECT_NO_THROW(reader.wait());
+  EXPECT_EQ(99 * 100 / 2, sum);
+  for (const MultiCore::AsyncHandle & handle : {failing, child, grand_child, diamond}) {
+    try {
+      handle.wait();
+      ADD_FAILURE() << "no exception forwarded";
+    }
+    catch (const std::runtime_error & exc) {
+      EXPECT_EQ(std::string("failing task"), exc.what());
+    }
+  }
+  EXPECT_EQ(0, nb_dependent_runs.load());
+  // Dependencies which already failed are also forwarded
+  ASSERT_TRUE(failing.isReady());
+  MultiCore::AsyncHandle late = MultiCore::runAsyncTask(dependent_task, 10, 2, {failing});
+  EXPECT_THROW(late.wait(), std::runtime_error);
+  EXPECT_EQ(0, nb_dependent_runs.load());
+  EXPECT_THROW(MultiCore::AsyncHandle().wait(), std::logic_error);
+}
+
+TEST(MultiCore, parallelForVisitsEachPointOnce)
+{
+  // Tile sizes do not divide the sizes, tiles at the upper border are smaller
+  std::vector<int> sizes = {13, 7, 5};
+  std::vector<int> tile_sizes = {4, 3, 5};
+  std::vector<std::atomic<int>> nb_visits(13 * 7 * 5);
+  std::atomic<int> nb_tiles(0);
+  MultiCore::parallelFor([&](const std::vector<int> & start, const std::vector<int> & end)
+                         {
+                           nb_tiles++;
+                           for (int dim = 0; dim < 3; dim++) {
+                             ASSERT_LT(start[dim], end[dim]);
+                             ASSERT_LE(end[dim] - start[dim], tile_sizes[dim]);
+                             ASSERT_LE(end[dim], sizes[dim]);
+                           }
+                           for (int z = start[2]; z < end[2]; z++) {
+                             for (int y = start[1]; y < end[1]; y++) {
+                               for (int x = start[0]; x < end[0]; x++) {
+                                 nb_visits[x + 13 * (y + 7 * z)]++;
+                               }
+                             }
+                           }
+                         }, sizes, tile_sizes, 4);
+  EXPECT_EQ(4 * 3 * 1, nb_tiles.load());
+  for (size_t idx = 0; idx < nb_visits.size(); idx++) {
+    ASSERT_EQ(1, nb_visits[idx].load()) << "point " << idx;
+  }
+  // Empty boxes have no tiles
+  MultiCore::parallelFor([](const std::vector<int> &, const std::vector<int> &)
+                         {
+                           FAIL() << "tile in an empty box";
+                         }, {10, 0}, {3, 3}, 2);
+}
+
+TEST(MultiCore, parallelForRejectsTooManyTiles)
+{
+  std::vector<int> sizes(3, 2000);
+  std::vector<int> tile_sizes(3, 1);
+  std::atomic<int> nb_tiles(0);
+  EXPECT_THROW(MultiCore::parallelFor([&nb_tiles](const std::vector<int> &,
+                                                  const std::vector<int> &) { nb_tiles++; },
+                                      sizes, tile_sizes, 2),
+               std::logic_error);
+  EXPECT_EQ(0, nb_tiles.load());
+  // Near the limit of an int, the last tiles are clipped without overflow
+  std::vector<int> large = {std::numeric_limits<int>::max()};
+  std::vector<int> large_tiles = {std::numeric_limits<int>::max() / 2 + 1};
+  std::vector<std::pair<int,int>> tiles(2);
+  MultiCore::parallelFor([&tiles, &large_tiles](const std::vector<int> & start,
+                                                const std::vector<int> & end)
+                         {
+                           tiles[start[0] / large_tiles[0]] = std::make_pair(start[0], end[0]);
+                         }, large, large_tiles, 2);
+  EXPECT_EQ(std::make_pair(0, large_tiles[0]), tiles[0]);
+  EXPECT_EQ(std::make_pair(large_tiles[0], std::numeric_limits<int>::max()), tiles[1]);
+}
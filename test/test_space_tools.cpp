@@ -0,0 +1,34 @@
+#include "rosban_utils/space_tools.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <vector>
+
+using namespace rosban_utils;
+
+TEST(SpaceTools, parallelForGridVisitsEachPointOnce)
+{
+  Eigen::MatrixXd limits(3, 2);
+  limits << 0, 1, -1, 1, 2, 4;
+  std::vector<int> samples_by_dim = {11, 6, 5};
+  Eigen::MatrixXd grid = discretizeSpace(limits, samples_by_dim);
+  ASSERT_EQ(11 * 6 * 5, grid.cols());
+  std::vector<std::atomic<int>> nb_visits(grid.cols());
+  // Tiles of 4 points at most: 4x1x1, the last tile along the first dimension
+  // only contains 3 points
+  int tile_bytes = 4 * 3 * sizeof(double);
+  parallelForGrid(grid, samples_by_dim,
+                  [&grid, &nb_visits](int point_idx, Eigen::MatrixXd::ConstColXpr point)
+                  {
+                    ASSERT_EQ(grid.col(point_idx), point);
+                    nb_visits[point_idx]++;
+                  }, 4, tile_bytes);
+  for (size_t idx = 0; idx < nb_visits.size(); idx++) {
+    ASSERT_EQ(1, nb_visits[idx].load()) << "point " << idx;
+  }
+  // Inconsistent description of the grid
+  EXPECT_THROW(parallelForGrid(grid, {11, 6, 4},
+                               [](int, Eigen::MatrixXd::ConstColXpr) {}, 2),
+               std::runtime_error);
+}
@@ -0,0 +1,283 @@
+#include "rosban_utils/archive.h"
+#include "rosban_utils/factory.h"
+#include "rosban_utils/stream_serializable.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace rosban_utils;
+
+namespace
+{
+
+/// Only implements the std::stream based methods, as existing classes do
+class LegacyObject : public StreamSerializable
+{
+public:
+  LegacyObject(int nb_values = 100) : values(nb_values, 1.5) {}
+
+  int getClassID() const override { return 3; }
+
+  using StreamSerializable::writeInternal;
+  using StreamSerializable::read;
+
+  int writeInternal(std::ostream & out) const override
+  {
+    return writeDoubleArray(out, values.data(), values.size());
+  }
+
+  int read(std::istream & in) override
+  {
+    return readDoubleArray(in, values.data(), values.size());
+  }
+
+  std::vector<double> values;
+};
+
+/// Same content as LegacyObject, but read directly from BinaryReader
+class BufferedObject : public LegacyObject
+{
+public:
+  using LegacyObject::read;
+
+  int read(BinaryReader & in) override
+  {
+    return readDoubleArray(in, values.data(), values.size());
+  }
+};
+
+/// Number of values of the objects spanning several compression blocks
+const int nb_large_values = 3 * LZ_BLOCK_SIZE / sizeof(double) + 1000;
+
+std::string readFile(const std::string & path)
+{
+  std::ifstream in(path, std::ios::binary);
+  std::ostringstream oss;
+  oss << in.rdbuf();
+  return oss.str();
+}
+
+void writeFile(const std::string & path, const std::string & content)
+{
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(content.data(), content.size());
+}
+
+}
+
+TEST(StreamSerializable, serializedSizeMatchesWrite)
+{
+  LegacyObject object;
+  std::ostringstream oss;
+  int bytes_written = object.write(oss);
+  EXPECT_EQ(bytes_written, (int)sizeof(int) + object.getSerializedSize());
+}
+
+TEST(StreamSerializable, writeToExactBuffer)
+{
+  LegacyObject object;
+  std::ostringstream oss;
+  object.write(oss);
+  std::vector<char> buffer(sizeof(int) + object.getSerializedSize());
+  EXPECT_EQ((int)buffer.size(), object.writeTo(buffer.data(), buffer.size()));
+  EXPECT_EQ(oss.str(), std::string(buffer.data(), buffer.size()));
+}
+
+TEST(StreamSerializable, writeToSmallBufferThrows)
+{
+  LegacyObject object;
+  std::vector<char> buffer(64);
+  EXPECT_THROW(object.writeTo(buffer.data(), buffer.size()), std::runtime_error);
+}
+
+TEST(Archive, partialFooterIsNotTakenForARecord)
+{
+  std::string path = testing::TempDir() + "partial_footer.rbar";
+  LegacyObject object;
+  {
+    ArchiveWriter writer(path);
+    for (int record = 0; record < 3; record++) {
+      object.values[0] = record;
+      writer.write(object);
+    }
+  }
+  // Only the offsets of the footer were written
+  std::ifstream in(path, std::ios::binary | std::ios::ate);
+  off_t size = in.tellg();
+  in.close();
+  ASSERT_EQ(0, truncate(path.c_str(), size - 2 * sizeof(uint64_t) - 4));
+  EXPECT_EQ(3u, ArchiveReader(path).getNbRecords());
+  {
+    ArchiveWriter writer(path, true);
+    object.values[0] = 3;
+    EXPECT_EQ(3u, writer.write(object));
+  }
+  ArchiveReader reader(path);
+  ASSERT_EQ(4u, reader.getNbRecords());
+  for (size_t record = 0; record < reader.getNbRecords(); record++) {
+    reader.read(record, object);
+    EXPECT_EQ(record, object.values[0]);
+  }
+  std::remove(path.c_str());
+}
+
+TEST(Archive, overflowingFooterIsIgnored)
+{
+  std::string path = testing::TempDir() + "overflowing_footer.rbar";
+  LegacyObject object;
+  {
+    ArchiveWriter writer(path);
+    for (int record = 0; record < 3; record++) {
+      object.values[0] = record;
+      writer.write(object);
+    }
+  }
+  // Number of records such that the size of the offsets wraps to the real one
+  std::string content = readFile(path);
+  uint64_t nb_records = (uint64_t(1) << 61) + 3;
+  std::memcpy(&content[content.size() - 2 * sizeof(uint64_t) - 4], &nb_records, sizeof(uint64_t));
+  writeFile(path, content);
+  // Records are found by scanning the file
+  ArchiveReader reader(path);
+  ASSERT_EQ(3u, reader.getNbRecords());
+  for (size_t record = 0; record < reader.getNbRecords(); record++) {
+    reader.read(record, object);
+    EXPECT_EQ(record, object.values[0]);
+  }
+  std::remove(path.c_str());
+}
+
+TEST(Compression, compressedSaveIsDetectedByLoad)
+{
+  std::string path = testing::TempDir() + "compressed.bin";
+  LegacyObject object(nb_large_values);
+  for (int idx = 0; idx < nb_large_values; idx++) {
+    object.values[idx] = std::round(1000 * std::sin(idx * 1e-3)) / 1000;
+  }
+  size_t raw_size = nb_large_values * sizeof(double);
+  EXPECT_EQ((int)raw_size, object.save(path, Compression::LZ, false));
+  EXPECT_LT(readFile(path).size(), raw_size / 2);
+  LegacyObject loaded(nb_large_values);
+  loaded.load(path);
+  EXPECT_EQ(object.values, loaded.values);
+  // With the class ID, through a factory
+  object.save(path, Compression::LZ);
+  Factory<LegacyObject> factory;
+  factory.registerBuilder(3, []() { return std::unique_ptr<LegacyObject>(
+                                         new LegacyObject(nb_large_values)); });
+  std::unique_ptr<LegacyObject> built;
+  EXPECT_EQ((int)(sizeof(int) + raw_size), factory.loadFromFile(path, built));
+  EXPECT_EQ(object.values, built->values);
+  std::remove(path.c_str());
+}
+
+TEST(Compression, incompressibleDataIsStored)
+{
+  std::string path = testing::TempDir() + "incompressible.bin";
+  LegacyObject object(nb_large_values);
+  std::mt19937_64 engine(42);
+  for (int idx = 0; idx < nb_large_values; idx++) {
+    uint64_t bits = engine();
+    std::memcpy(&object.values[idx], &bits, sizeof(double));
+  }
+  object.save(path, Compression::LZ, false);
+  std::string content = readFile(path);
+  size_t raw_size = nb_large_values * sizeof(double);
+  EXPECT_LT(content.size(), raw_size + 1024);
+  // Compressed size of the first block, after magic and version
+  uint32_t compressed_size;
+  std::memcpy(&compressed_size, content.data() + 2 * sizeof(int), sizeof(uint32_t));
+  EXPECT_NE(0u, compressed_size & 0x80000000u);
+  LegacyObject loaded(nb_large_values);
+  loaded.load(path);
+  // Compared as bits, random values include NaNs
+  EXPECT_EQ(0, std::memcmp(object.values.data(), loaded.values.data(), raw_size));
+  std::remove(path.c_str());
+}
+
+TEST(Compression, corruptedDataIsRejected)
+{
+  std::vector<char> raw(4096);
+  for (size_t idx = 0; idx < raw.size(); idx++) {
+    raw[idx] = (idx * idx / 7) % 13;
+  }
+  std::vector<char> compressed(lzCompressBound(raw.size()));
+  compressed.resize(lzCompress(raw.data(), raw.size(), compressed.data()));
+  std::vector<char> decompressed(raw.size());
+  lzDecompress(compressed.data(), compressed.size(), decompressed.data(), raw.size());
+  EXPECT_EQ(raw, decompressed);
+  for (size_t size = 0; size < compressed.size(); size++) {
+    EXPECT_THROW(lzDecompress(compressed.data(), size, decompressed.data(), raw.size()),
+                 std::runtime_error);
+  }
+  EXPECT_THROW(lzDecompress(compressed.data(), compressed.size(),
+                            decompressed.data(), raw.size() - 1),
+               std::runtime_error);
+  // Random data either fails or stays in bounds, checked by sanitizers
+  std::mt19937 engine(42);
+  std::vector<char> garbage(256);
+  for (int trial = 0; trial < 1000; trial++) {
+    for (char & byte : garbage) {
+      byte = engine();
+    }
+    try {
+      lzDecompress(garbage.data(), garbage.size(), decompressed.data(), decompressed.size());
+    }
+    catch (const std::runtime_error & exc) {
+    }
+  }
+  // Truncated file
+  std::string path = testing::TempDir() + "truncated.bin";
+  LegacyObject object(nb_large_values);
+  object.save(path, Compression::LZ, false);
+  std::string content = readFile(path);
+  writeFile(path, content.substr(0, content.size() / 2));
+  LegacyObject loaded(nb_large_values);
+  EXPECT_THROW(loaded.load(path), std::runtime_error);
+  std::remove(path.c_str());
+}
+
+TEST(StreamSerializable, mappedLoadMatchesStreamRead)
+{
+  std::string path = testing::TempDir() + "mapped_load.bin";
+  LegacyObject object(1000);
+  for (size_t idx = 0; idx < object.values.size(); idx++) {
+    object.values[idx] = idx / 3.0;
+  }
+  object.save(path, false);
+  // Reading the file through a stream, as load did before mappings
+  LegacyObject streamed(1000);
+  {
+    std::ifstream in(path, std::ios::binary);
+    streamed.read(in);
+  }
+  LegacyObject legacy(1000);
+  legacy.load(path);
+  BufferedObject buffered;
+  buffered.values.resize(1000);
+  buffered.load(path);
+  EXPECT_EQ(object.values, streamed.values);
+  EXPECT_EQ(streamed.values, legacy.values);
+  EXPECT_EQ(streamed.values, buffered.values);
+  std::remove(path.c_str());
+}
+
+TEST(StreamSerializable, loadErrors)
+{
+  std::string path = testing::TempDir() + "load_errors.bin";
+  std::remove(path.c_str());
+  BufferedObject object;
+  EXPECT_THROW(object.load(path), std::runtime_error);
+  writeFile(path, "");
+  EXPECT_THROW(object.load(path), std::runtime_error);
+  std::remove(path.c_str());
+}